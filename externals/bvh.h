@@ -249,6 +249,8 @@ public:
     // Fast Traversal System
     BVHFlatNode *flatTree;
 
+    uint32_t getNbNodes() const { return nNodes; }
+
 public:
 
 //! - Compute the nearest intersection of all objects within the tree.
@@ -276,6 +278,7 @@ public:
             float near = todo[stackptr].mint;
             stackptr--;
             const BVHFlatNode &node(flatTree[ ni ]);
+            TR_STATS_NODE_VISIT();
 
             // If this node is further than the closest found intersection, continue
             if(near > intersection->t)
@@ -287,6 +290,7 @@ public:
                     IntersectionInfo current;
 
                     const Object* obj = (*build_prims)[node.start+o];
+                    TR_STATS_PRIM_TEST();
                     bool hit = obj->getIntersection(ray, &current);
 
                     if (hit) {
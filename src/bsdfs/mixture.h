@@ -18,8 +18,9 @@ struct MixtureBSDF : BSDF {
     std::unique_ptr<Texture < v3f>> specularReflectance;
     std::unique_ptr<Texture < v3f>> diffuseReflectance;
     std::unique_ptr<Texture < float>> exponent;
-    float specularSamplingWeight;
-    float scale;
+    mutable std::once_flag weightsComputed;
+    mutable float specularSamplingWeight;
+    mutable float scale;
 
     MixtureBSDF(const WorldData& scene, const Config& config, const size_t& matID) : BSDF(scene, config, matID) {
         const tinyobj::material_t& mat = scene.materials[matID];
@@ -36,15 +37,6 @@ struct MixtureBSDF : BSDF {
 
         exponent = std::unique_ptr<Texture<float>>(new ConstantTexture1f(mat.shininess));
 
-        //get scale value to ensure energy conservation
-        v3f maxValue = specularReflectance->getMax() + diffuseReflectance->getMax();
-        float actualMax = max(max(maxValue.x, maxValue.y), maxValue.z);
-        scale = actualMax > 1.0f ? 0.99f * (1.0f / actualMax) : 1.0f;
-
-        float dAvg = getLuminance(diffuseReflectance->getAverage() * scale);
-        float sAvg = getLuminance(specularReflectance->getAverage() * scale);
-        specularSamplingWeight = sAvg / (dAvg + sAvg);
-
         components.push_back(EGlossyReflection);
         components.push_back(EDiffuseReflection);
 
@@ -53,6 +45,33 @@ struct MixtureBSDF : BSDF {
             combinedType |= component;
     }
 
+    /**
+     * Energy conservation scale and specular sampling weight, from the texture statistics. Computed on first use:
+     * at construction they would wait for (or run) the decoding of the bitmap textures.
+     */
+    void computeWeights() const {
+        std::call_once(weightsComputed, [this]() {
+            //get scale value to ensure energy conservation
+            v3f maxValue = specularReflectance->getMax() + diffuseReflectance->getMax();
+            float actualMax = max(max(maxValue.x, maxValue.y), maxValue.z);
+            scale = actualMax > 1.0f ? 0.99f * (1.0f / actualMax) : 1.0f;
+
+            float dAvg = getLuminance(diffuseReflectance->getAverage() * scale);
+            float sAvg = getLuminance(specularReflectance->getAverage() * scale);
+            specularSamplingWeight = sAvg / (dAvg + sAvg);
+        });
+    }
+
+    float getScale() const {
+        computeWeights();
+        return scale;
+    }
+
+    float getSpecularSamplingWeight() const {
+        computeWeights();
+        return specularSamplingWeight;
+    }
+
     inline v3f reflect(const v3f& d) const {
         return v3f(-d.x, -d.y, d.z);
     }
@@ -67,7 +86,7 @@ struct MixtureBSDF : BSDF {
             float ang = glm::angle(reflect(i.wi), i.wo);
             float cosAlpha = std::pow(std::max(0.f, cos(std::max(0.f, ang))), expo);
 
-            val = scale * (diffuse / M_PI + specular * (expo + 2.f) * INV_TWOPI * cosAlpha) * i.frameNs.cosTheta(i.wi); //TODO: Check if I need to remove scale
+            val = getScale() * (diffuse / M_PI + specular * (expo + 2.f) * INV_TWOPI * cosAlpha) * i.frameNs.cosTheta(i.wi); //TODO: Check if I need to remove scale
             //val = scale * (specular * (expo + 2.f) * INV_TWOPI * cosAlpha) * i.frameNs.cosTheta(i.wi);
         }
 
@@ -87,11 +106,13 @@ struct MixtureBSDF : BSDF {
 
         bsdfPdf = fmax(Warp::squareToCosineHemispherePdf(i.wi), 0.f);
 
+        const float specularSamplingWeight = getSpecularSamplingWeight();
         return phongPdf * specularSamplingWeight + bsdfPdf * (1 - specularSamplingWeight);
     }
 
     v3f sample(SurfaceInteraction& i, const v2f& _sample, float* pdf) const override {
         v3f val(0.f);
+        const float specularSamplingWeight = getSpecularSamplingWeight();
 
         //if diffuse
         if(_sample.x > specularSamplingWeight){  //TODO: Check if the less than is reversed
@@ -19,24 +19,18 @@ struct AcceleratorBVH {
 
     struct BVHNode : Object {
 
-        const size_t shapeID, faceID;
-        const WorldData& worldData;
+        const size_t shapeID, primID, triID;
+        const GeometryStore& geometry;
 
-        BVHNode(size_t j, size_t i, const WorldData& d) : shapeID(j), faceID(i), worldData(d) { }
+        BVHNode(size_t j, size_t i, const GeometryStore& g) :
+            shapeID(j), primID(i), triID(g.getTriangle(j, i)), geometry(g) { }
+
+        virtual ~BVHNode() = default;
 
         bool getIntersection(const Ray& ray, IntersectionInfo* intersection) const override {
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
+            const v3f& v0 = geometry.getPosition(triID, 0);
+            const v3f& v1 = geometry.getPosition(triID, 1);
+            const v3f& v2 = geometry.getPosition(triID, 2);
 
             float t, u, v;
             if (rayTriangleIntersect(ray, v0, v1, v2, t, u, v)) {
@@ -52,58 +46,97 @@ struct AcceleratorBVH {
         }
 
         v3f getNormal(const IntersectionInfo&) const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.normals[3 * idx0.normal_index + 0], a.normals[3 * idx0.normal_index + 1],
-                            a.normals[3 * idx0.normal_index + 2]};
-            const v3f v1 = {a.normals[3 * idx1.normal_index + 0], a.normals[3 * idx1.normal_index + 1],
-                            a.normals[3 * idx1.normal_index + 2]};
-            const v3f v2 = {a.normals[3 * idx2.normal_index + 0], a.normals[3 * idx2.normal_index + 1],
-                            a.normals[3 * idx2.normal_index + 2]};
+            const v3f& v0 = geometry.getNormal(triID, 0);
+            const v3f& v1 = geometry.getNormal(triID, 1);
+            const v3f& v2 = geometry.getNormal(triID, 2);
 
             return glm::normalize(glm::cross(v1 - v0, v2 - v0));
         }
 
         BBox getBBox() const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
-
-            BBox b(v0);
-            b.expandToInclude(v1);
-            b.expandToInclude(v2);
+            BBox b(geometry.getPosition(triID, 0));
+            b.expandToInclude(geometry.getPosition(triID, 1));
+            b.expandToInclude(geometry.getPosition(triID, 2));
             return b;
         }
 
         v3f getCentroid() const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
+            const v3f& v0 = geometry.getPosition(triID, 0);
+            const v3f& v1 = geometry.getPosition(triID, 1);
+            const v3f& v2 = geometry.getPosition(triID, 2);
 
             return (v0 + v1 + v2) / 3.0f;
         }
+
+        /**
+         * Fills the position, surface coordinates and frames of a hit.
+         */
+        virtual void getSurface(const Ray& ray, const IntersectionInfo& iInfo, SurfaceInteraction& info) const {
+            const GeometryStore& g = geometry;
+            const size_t tri = triID;
+            const v3f& v0 = g.getPosition(tri, 0);
+            const v3f& v1 = g.getPosition(tri, 1);
+            const v3f& v2 = g.getPosition(tri, 2);
+
+            info.u = iInfo.u;
+            info.v = iInfo.v;
+            info.p = barycentric(v0, v1, v2, iInfo.u, iInfo.v);
+            if (!g.records.empty()) {
+                const TriangleRecord& r = g.records[tri];
+                info.frameNg = Frame(r.s, r.t, r.n);
+                info.frameNs = r.flat ? info.frameNg
+                                      : Frame(glm::normalize(barycentric(g.getNormal(tri, 0), g.getNormal(tri, 1),
+                                                                         g.getNormal(tri, 2), info.u, info.v)));
+            } else {
+                info.frameNg = Frame(glm::normalize(glm::cross(v1 - v0, v2 - v0)));
+                info.frameNs = Frame(glm::normalize(barycentric(g.getNormal(tri, 0), g.getNormal(tri, 1),
+                                                                g.getNormal(tri, 2), info.u, info.v)));
+            }
+        }
+    };
+
+    /**
+     * Analytic emitter standing for all the triangles of its shape; hits report its first triangle.
+     */
+    struct AnalyticNode : BVHNode {
+
+        const AnalyticShape& shape;
+
+        AnalyticNode(size_t j, const AnalyticShape& shape, const GeometryStore& g) : BVHNode(j, 0, g), shape(shape) { }
+
+        bool getIntersection(const Ray& ray, IntersectionInfo* intersection) const override {
+            float t;
+            if (!shape.intersect(ray, t)) return false;
+            intersection->t = t;
+            intersection->u = 0.f;
+            intersection->v = 0.f;
+            intersection->object = this;
+            return true;
+        }
+
+        /** Rectangles only: the normal of a sphere depends on the hit point (see getSurface). */
+        v3f getNormal(const IntersectionInfo& iInfo) const override {
+            return shape.n;
+        }
+
+        BBox getBBox() const override {
+            const AABB b = shape.getBounds();
+            return BBox(b.min, b.max);
+        }
+
+        v3f getCentroid() const override {
+            return shape.getBounds().getCenter();
+        }
+
+        void getSurface(const Ray& ray, const IntersectionInfo& iInfo, SurfaceInteraction& info) const override {
+            info.u = 0.f;
+            info.v = 0.f;
+            info.p = ray.o + iInfo.t * ray.d;
+            if (shape.type == AnalyticShape::ESphere)
+                info.p = shape.p + shape.radius * glm::normalize(info.p - shape.p);
+            info.frameNg = Frame(shape.getNormal(info.p));
+            info.frameNs = info.frameNg;
+        }
     };
 
     std::unique_ptr<BVH> bvh;
@@ -112,55 +145,50 @@ struct AcceleratorBVH {
 
     explicit AcceleratorBVH(const WorldData& worldData) : worldData(worldData) { }
 
+    /** The primitives are owned here, the BVH only references them (Object has no virtual destructor). */
+    ~AcceleratorBVH() {
+        for (Object* o : objects) delete static_cast<BVHNode*>(o);
+    }
+
     bool build() {
+        const GeometryStore& g = worldData.geometry;
+        objects.reserve(g.getNbTriangles());
         for (size_t j = 0; j < worldData.shapes.size(); j++) {
-            const tinyobj::shape_t& shape = worldData.shapes[j];
-            for (size_t i = 0; i < shape.mesh.indices.size(); i += 3)
-                objects.emplace_back(new BVHNode(j, i, worldData));
+            if (worldData.shapesAnalytic[j].type != AnalyticShape::ENone) {
+                objects.emplace_back(new AnalyticNode(j, worldData.shapesAnalytic[j], g));
+                continue;
+            }
+            for (size_t i = 0; i < g.getNbTriangles(j); i++)
+                objects.emplace_back(new BVHNode(j, i, g));
         }
         bvh = std::unique_ptr<BVH>(new BVH(&objects));
         return true;
     }
 
+    /** Memory held by the tree nodes and the primitives, in bytes. */
+    size_t getMemoryUsage() const {
+        return (bvh ? bvh->getNbNodes() * sizeof(BVHFlatNode) : 0)
+               + objects.capacity() * sizeof(Object*) + objects.size() * sizeof(BVHNode);
+    }
+
     bool intersect(const Ray& ray, SurfaceInteraction& info) const {
         IntersectionInfo iInfo{};
         iInfo.object = nullptr;
-        const std::vector<tinyobj::shape_t>& ss = worldData.shapes;
-        const tinyobj::attrib_t& sa = worldData.attrib;
+        const GeometryStore& g = worldData.geometry;
 
         if (bvh->getIntersection(ray, &iInfo, false)) {
             info.t = iInfo.t;
             if (iInfo.t <= ray.max_t && iInfo.t >= ray.min_t) {
-                const tinyobj::shape_t& s = ss[((BVHNode*) (iInfo.object))->shapeID];
-                const size_t i = ((BVHNode*) (iInfo.object))->faceID;
-                const tinyobj::index_t& idx0 = s.mesh.indices[i + 0];
-                const tinyobj::index_t& idx1 = s.mesh.indices[i + 1];
-                const tinyobj::index_t& idx2 = s.mesh.indices[i + 2];
-
-                const v3f v0 = {sa.vertices[3 * idx0.vertex_index + 0], sa.vertices[3 * idx0.vertex_index + 1],
-                                sa.vertices[3 * idx0.vertex_index + 2]};
-                const v3f v1 = {sa.vertices[3 * idx1.vertex_index + 0], sa.vertices[3 * idx1.vertex_index + 1],
-                                sa.vertices[3 * idx1.vertex_index + 2]};
-                const v3f v2 = {sa.vertices[3 * idx2.vertex_index + 0], sa.vertices[3 * idx2.vertex_index + 1],
-                                sa.vertices[3 * idx2.vertex_index + 2]};
-
-                const v3f n0 = {sa.normals[3 * idx0.normal_index + 0], sa.normals[3 * idx0.normal_index + 1],
-                                sa.normals[3 * idx0.normal_index + 2]};
-                const v3f n1 = {sa.normals[3 * idx1.normal_index + 0], sa.normals[3 * idx1.normal_index + 1],
-                                sa.normals[3 * idx1.normal_index + 2]};
-                const v3f n2 = {sa.normals[3 * idx2.normal_index + 0], sa.normals[3 * idx2.normal_index + 1],
-                                sa.normals[3 * idx2.normal_index + 2]};
-
-                info.shapeID = ((BVHNode*) (iInfo.object))->shapeID;
-                info.primID = ((BVHNode*) (iInfo.object))->faceID / 3;
+                const BVHNode* node = (const BVHNode*) iInfo.object;
+
+                info.shapeID = node->shapeID;
+                info.primID = node->primID;
                 info.t = iInfo.t;
-                info.u = iInfo.u;
-                info.v = iInfo.v;
-                info.p = barycentric(v0, v1, v2, iInfo.u, iInfo.v);
-                info.frameNg = Frame(glm::normalize(glm::cross(v1 - v0, v2 - v0)));
-                info.frameNs = Frame(glm::normalize(barycentric(n0, n1, n2, info.u, info.v)));
+                node->getSurface(ray, iInfo, info);
                 info.wo = info.frameNs.toLocal(-ray.d);
-                info.matID = s.mesh.material_ids[info.primID];
+                info.matID = g.materialIDs[node->triID];
+                info.footprint = ray.width + ray.spread * iInfo.t;
+                info.spread = ray.spread;
                 return true;
             }
             return false;
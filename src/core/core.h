@@ -9,12 +9,21 @@
 
 #include <GL/glew.h>
 #include <functional>
+#include <future>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include "platform.h"
 #include "math.h"
+#include "sampler.h"
 #include "utils.h"
+#include "stats.h"
 #include "cpptoml.h"
 #include "tiny_obj_loader.h"
+#include "geometry.h"
+#include "texture.h"
 #include "camera.h"
+#include "memory.h"
 
 TR_NAMESPACE_BEGIN
 
@@ -23,6 +32,16 @@ enum ESamplingMeasure{
     EAreaMeasure
 };
 
+/**
+ * Emitter sampling strategy enumeration.
+ * How a point is sampled on an emitter triangle for next event estimation.
+ */
+enum EEmitterSampling {
+    EAreaEmitterSampling = 0,               // Uniformly by area
+    ESolidAngleEmitterSampling,             // Uniformly in the solid angle it subtends (Arvo's spherical triangle)
+    EProjectedSolidAngleEmitterSampling     // Same, warped by the approximate cosine at the shading point
+};
+
 /**
  * Integrator enumeration.
  * A new item needs to be added when creating a new integrator.
@@ -35,6 +54,7 @@ enum EIntegrator {
     EDirectIntegrator,
     EPathTracerIntegrator,
     EPhotonMapperIntegrator,
+    EReSTIRIntegrator,
     EIntegrators
 };
 
@@ -115,6 +135,7 @@ struct AABB {
 struct Ray {
     v3f o, d;
     float min_t, max_t;
+    float width{0.f}, spread{0.f};  // Ray cone (texture footprint): width at the origin and spread angle
     Ray(const v3f& co, const v3f& cd, float min_t = Epsilon, float max_t = std::numeric_limits<float>::max())
         : o(co), d(cd), min_t(min_t), max_t(max_t) { }
 };
@@ -141,6 +162,9 @@ struct RenderBuffer {
     void clear() {
         for (int i = 0; i < height * width; data[i++] = v3f(0.f));
     }
+    size_t getMemoryUsage() const {
+        return size_t(width) * height * sizeof(v3f);
+    }
 };
 
 /**
@@ -153,6 +177,7 @@ struct Frame {
     explicit Frame(const v3f& n) : n(n) {
         coordinateSystem(n, s, t);
     }
+    explicit Frame(const v3f& s, const v3f& t, const v3f& n) : s(s), t(t), n(n) { }
     v3f toLocal(const v3f& v) const {
         return v3f(glm::dot(v, s), glm::dot(v, t), glm::dot(v, n));
     }
@@ -174,6 +199,7 @@ struct SurfaceInteraction {
     size_t shapeID, primID;
     Frame frameNg, frameNs;
     int matID;
+    float footprint{0.f}, spread{0.f};  // Ray cone width at the hit point and spread angle
     unsigned int sampledComponent, sampledType;
 };
 
@@ -189,17 +215,30 @@ struct Camera {
 /**
  * Configuration structure to render a scene.
  * Stores integrator, camera setup, image plane dimensions, sample count, etc.
+ * Settings that only the offline renderer parses default to their TOML defaults, as real-time passes (e.g. the
+ * GI bake) reach the same code paths.
  */
 struct Config {
     EIntegrator integrator;
     ERenderPass renderpass;
     Camera camera;
     fs::path objFile, tomlFile;
+    bool meshCache;
+    bool triangleRecords;
+    float weldEpsilon;          // Vertices closer than this (position, normal and uv) are merged at load, 0 for exact welding only
+    int textureCompression;     // Texel count from which bitmap textures are BC1-compressed (0: never)
+    int textureBudget;          // Texture memory budget in MB, textures are streamed by tiles if > 0
+    string textureLoading;      // When bitmap textures are decoded: "lazy", "async" or "eager"
+    bool textureSAT;            // Build summed-area tables for box-filtered texture lookups
+    bool lightTree;             // Pick emitter triangles per shading point from a light tree (instead of by power)
+    bool analyticEmitters;      // Replace emitter shapes that are tessellated spheres or rectangles by exact primitives
     int width, height, spp;
-    union IntegratorConfig {
-        IntegratorConfig() : di{}{};
-        ~IntegratorConfig() {}
-
+    ESampler sampler{EIndependentSampler};  // Sample generator of the offline renderer
+    bool blueNoise{false};      // Dither the samples of each pixel with a blue-noise mask (for low-spp previews)
+    EEmitterSampling emitterSampling{EAreaEmitterSampling};    // Sampling of emitter triangles for next event estimation
+    bool lightCache{false};     // Learn emitter selection per grid cell from the shadow rays (without light tree)
+    int lightCacheResolution{16};   // Cells of the light cache along the largest axis of the scene
+    struct IntegratorConfig {     // Settings of each integrator (a struct rather than a union, so that Config is copyable)
         struct direct_s {
             size_t emitterSamples{};
             size_t bsdfSamples{};
@@ -223,19 +262,28 @@ struct Config {
         } ao;
         struct ro_s{
             float exponent;
-        } ro;
+        } ro{};
         struct pt_s{
             bool isExplicit;
             int maxDepth;
             int rrDepth;
             float rrProb;
-        } pt;
+            int risCandidates;
+        } pt{};
         struct gi_s{
             int maxDepth;
             int rrDepth;
             float rrProb;
             int samplesByVertex;
-        } gi;
+        } gi{};
+        struct rs_s{
+            int candidates;
+            int spatialSamples;
+            float spatialRadius;
+            bool temporal;
+            int maxHistory;
+            bool unbiased;
+        } rs{};
     } integratorSettings;
 };
 
@@ -309,6 +357,124 @@ struct BSDF {
     virtual std::string toString() const = 0;
 };
 
+/**
+ * Exact primitive standing for the triangles of an emitter shape (see Config::analyticEmitters):
+ * a sphere of center p, or a rectangle of corner p and orthogonal edges ex, ey, emitting on the side of n.
+ * Intersected in closed form and sampled uniformly in the solid angle it subtends.
+ */
+struct AnalyticShape {
+    enum EType { ENone = 0, ESphere, ERectangle };
+    EType type{ENone};
+    v3f p{0.f};
+    float radius{0.f};
+    v3f ex{0.f}, ey{0.f}, n{0.f};
+
+    float getArea() const {
+        return type == ESphere ? 4.f * M_PI * radius * radius : glm::length(ex) * glm::length(ey);
+    }
+
+    AABB getBounds() const {
+        if (type == ESphere) {
+            AABB b(p - v3f(radius));
+            b.expandBy(p + v3f(radius));
+            return b;
+        }
+        AABB b(p);
+        b.expandBy(p + ex);
+        b.expandBy(p + ey);
+        b.expandBy(p + ex + ey);
+        return b;
+    }
+
+    v3f getNormal(const v3f& pos) const {
+        return type == ESphere ? glm::normalize(pos - p) : n;
+    }
+
+    /**
+     * Nearest intersection further than 1e-3 along the ray (both sides of the surface).
+     */
+    bool intersect(const Ray& ray, float& t) const {
+        if (type == ESphere) {
+            // Distance to the closest point of the line first, for precision far from the sphere
+            const v3f f = ray.o - p;
+            const float a = glm::dot(ray.d, ray.d);
+            const float b = -glm::dot(f, ray.d) / a;
+            const float disc = radius * radius - glm::length2(f + b * ray.d);
+            if (disc < 0.f) return false;
+            const float h = std::sqrt(disc / a);
+            t = b - h > 1e-3f ? b - h : b + h;
+            return t > 1e-3f;
+        }
+        const float dn = glm::dot(ray.d, n);
+        if (dn == 0.f) return false;
+        t = glm::dot(p - ray.o, n) / dn;
+        if (!(t > 1e-3f)) return false;
+        const v3f q = ray.o + t * ray.d - p;
+        const float u = glm::dot(q, ex) / glm::length2(ex), v = glm::dot(q, ey) / glm::length2(ey);
+        return u >= 0.f && u <= 1.f && v >= 0.f && v <= 1.f;
+    }
+
+    /**
+     * Samples a point seen from ref: in the cone of the sphere (by area from inside it), or in the spherical
+     * rectangle (by area if it subtends less than MinSolidAngle). Returns position, normal and PDF in area measure.
+     */
+    void sample(const p2f& sample, const v3f& ref, v3f& pos, v3f& normal, float& pdf) const {
+        if (type == ESphere) {
+            const float sin2ThetaMax = radius * radius / glm::distance2(ref, p);
+            if (sin2ThetaMax >= 1.f) {
+                normal = Warp::squareToUniformSphere(sample);
+                pos = p + radius * normal;
+                pdf = 1.f / getArea();
+                return;
+            }
+
+            // Angle theta from the cone axis, then angle alpha at the center between ref and the point
+            const float oneMinusCosThetaMax = sin2ThetaMax / (1.f + std::sqrt(1.f - sin2ThetaMax));
+            const float oneMinusCosTheta = sample.x * oneMinusCosThetaMax;
+            const float sin2Theta = oneMinusCosTheta * (2.f - oneMinusCosTheta);
+            const float cosAlpha = sin2Theta / std::sqrt(sin2ThetaMax)
+                                   + (1.f - oneMinusCosTheta) * safeSqrt(1.f - sin2Theta / sin2ThetaMax);
+            const float sinAlpha = safeSqrt(1.f - cosAlpha * cosAlpha);
+            const float phi = 2.f * M_PI * sample.y;
+            normal = Frame(glm::normalize(ref - p)).toWorld(v3f(sinAlpha * std::cos(phi), sinAlpha * std::sin(phi), cosAlpha));
+            pos = p + radius * normal;
+            pdf = std::abs(glm::dot(normal, glm::normalize(ref - pos))) / glm::distance2(ref, pos)
+                  / (2.f * M_PI * oneMinusCosThetaMax);
+            return;
+        }
+
+        float saPdf = 0.f;
+        normal = n;
+        if (Warp::sphericalRectangleArea(ref, p, ex, ey) >= MinSolidAngle)
+            pos = Warp::squareToSphericalRectangle(sample, ref, p, ex, ey, saPdf);
+        if (saPdf > 0.f) {
+            pdf = saPdf * std::abs(glm::dot(n, glm::normalize(ref - pos))) / glm::distance2(ref, pos);
+        } else {
+            pos = p + sample.x * ex + sample.y * ey;
+            pdf = 1.f / getArea();
+        }
+    }
+
+    /**
+     * PDF in area measure with which sample returns the point pos of normal normal for ref.
+     */
+    float getPdf(const v3f& ref, const v3f& pos, const v3f& normal) const {
+        const v3f wo = glm::normalize(ref - pos);
+        if (type == ESphere) {
+            const float sin2ThetaMax = radius * radius / glm::distance2(ref, p);
+            if (sin2ThetaMax >= 1.f) return 1.f / getArea();
+            const float oneMinusCosThetaMax = sin2ThetaMax / (1.f + std::sqrt(1.f - sin2ThetaMax));
+            return std::abs(glm::dot(normal, wo)) / glm::distance2(ref, pos) / (2.f * M_PI * oneMinusCosThetaMax);
+        }
+        const float solidAngle = Warp::sphericalRectangleArea(ref, p, ex, ey);
+        if (solidAngle < MinSolidAngle) return 1.f / getArea();
+        return std::abs(glm::dot(normal, wo)) / glm::distance2(ref, pos) / solidAngle;
+    }
+
+    /** Below this solid angle (sr), rectangles are sampled by area: it is as good, and more robust. */
+    static constexpr float MinSolidAngle = 3e-4f;
+};
+
 /**
  * Emitter/light structure.
  * Stores ID of shape attached to it, and radiance.
@@ -326,16 +492,20 @@ struct Emitter {
 /**
  * World data structure.
  * Stores all shapes and BSDFs with their attributes.
+ * Once loaded, the triangle data lives in the geometry store; the tinyobj shapes only keep their names.
  */
 struct WorldData {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
+    GeometryStore geometry;
     std::vector<tinyobj::material_t> materials;
     std::vector<v3f> shapesCenter;
     std::vector<AABB> shapesAABOX;
+    std::vector<AnalyticShape> shapesAnalytic;  // Exact primitive of each shape (ENone for triangle meshes)
 };
 
 struct AcceleratorBVH;
+struct LightTree;
 
 /**
  * Scene structure.
@@ -346,12 +516,31 @@ struct Scene {
     WorldData worldData;
     std::unique_ptr<AcceleratorBVH> bvh;
     std::vector<Emitter> emitters;
+    Distribution1D emitterDistribution;     // Emitter selection, proportional to power (alias table)
+    std::vector<int> shapeEmitterIDs;       // Emitter ID of each shape, -1 if not emissive
+    std::unique_ptr<LightTree> lightTree;   // Over the emissive triangles, if enabled
     std::vector<std::unique_ptr<BSDF>> bsdfs;
     AABB aabb;
 
     explicit Scene(const Config& config);
     bool load(bool isRealTime);
     float getShapeArea(size_t shapeID, Distribution1D& faceAreaDistribution);
+    void reportMemory(MemoryReport& report) const;
+
+    /** Absolute path of the OBJ file. */
+    fs::path getObjFile() const;
+
+    std::unique_ptr<BSDF> createBSDF(size_t matID);
+    void buildAnalyticShapes();
+    void buildEmitters();
+    void buildRecords();
+
+    /**
+     * Replaces the materials by new versions of the same materials (same names, same order) and rebuilds
+     * the BSDFs of the materials that changed, as well as the emitters if any emission changed.
+     * Returns the number of rebuilt BSDFs, or -1 if the materials do not match (the scene must be reloaded).
+     */
+    int updateMaterials(const std::vector<tinyobj::material_t>& materials);
     float getShapeRadius(const size_t shapeID) const;
     v3f getShapeCenter(const size_t shapeID) const;
     size_t getFirstLight() const;
@@ -405,18 +594,21 @@ struct Texture {
 /**
  * Main texture structure.
  * Stores width, height, and post-processing & loading methods.
+ * 8-bit (ppm) textures are kept as gamma-encoded bytes in bs (with their max value), float (pfm) textures in cs.
  */
 struct Tex {
     int w;
     int h;
+    int maxValue;
     std::vector<float> cs;
+    std::vector<uint8_t> bs;
 
     void pink() {
         w = 1;
         h = 1;
-        cs.emplace_back(1.f);
-        cs.emplace_back(0.f);
-        cs.emplace_back(1.f);
+        maxValue = 255;
+        cs = {1.f, 0.f, 1.f};
+        bs = {255, 0, 255};
     }
 
     // Calculate pixel coordinate of the vertically-flipped image
@@ -427,12 +619,6 @@ struct Tex {
         return 3 * ((h - y - 1) * w + x) + i % 3;
     }
 
-    // Post procses a pixel for pmp textures
-    inline float pf(int i, float e, std::vector<uint8_t>& ct) {
-        // Gamma expansion
-        return std::pow(float(ct[fl(i)]) / e, 2.2f);
-    }
-
     // Post procses a pixel for pmf textures
     inline float pf(int i, float e, std::vector<float>& ct) {
         if (e < 0) {
@@ -443,52 +629,70 @@ struct Tex {
         return *ptr;
     }
 
-    // Load a ppm or a pfm texture
+    // Read the raw (unflipped) texels of a ppm or a pfm file, returns the header's max value / scale
     template<class T>
-    inline void loadpxm(std::vector<float>& c, std::string p) {
-        puts(p.c_str());
-        static vector<T> ct;
+    inline bool readpxm(std::vector<T>& ct, const std::string& p, float& e) {
         FILE* f = fopen(p.c_str(), "rb");
         if (!f) {
             std::cout << "Err loading texture : " << p << std::endl;
             pink();
-            return;
+            return false;
         }
-        int e;
-        size_t read = fscanf(f, "%*s %d %d %d%*c", &w, &h, &e);
-        if (read == 0) {
+        size_t read = fscanf(f, "%*s %d %d %f%*c", &w, &h, &e);
+        if (read != 3) {
             std::cout << "Err loading texture : " << p << std::endl;
+            fclose(f);
             pink();
-            return;
+            return false;
         }
-        const int sz = w * h * 3;
-        ct.assign(sz, 0);
-        c.assign(sz, 0);
+        const size_t sz = size_t(w) * h * 3;
+        ct.resize(sz);
         read = fread(ct.data(), sizeof(T), sz, f);
-        if (read == 0) {
+        fclose(f);
+        if (read != sz) {
             std::cout << "Err loading texture : " << p << std::endl;
             pink();
-            return;
-        }
-        for (int i = 0; i < sz; i++) {
-            c[i] = pf(i, float(e), ct);
+            return false;
         }
-        fclose(f);
         std::cout << "Success loading texture : " << p << " w: " << w << " h: " << h << std::endl;
+        return true;
     }
 
     // Load pfm texture
     inline void loadpfm(string p) {
-        loadpxm<float>(cs, p);
+        std::vector<float> ct;
+        float e;
+        if (!readpxm<float>(ct, p, e)) return;
+        cs.resize(ct.size());
+        for (size_t i = 0; i < ct.size(); i++) {
+            cs[i] = pf(int(i), e, ct);
+        }
+    }
+
+    // Read the header of a binary 8-bit ppm, for random access to its rows. Returns the offset of the texels (-1 on failure)
+    inline long readppmHeader(const std::string& p) {
+        FILE* f = fopen(p.c_str(), "rb");
+        if (!f) return -1;
+        char magic[3] = {0, 0, 0};
+        const bool ok = fscanf(f, "%2s %d %d %d%*c", magic, &w, &h, &maxValue) == 4 && std::string(magic) == "P6"
+                        && maxValue > 0 && maxValue < 256;
+        const long offset = ok ? ftell(f) : -1;
+        fclose(f);
+        return offset;
     }
 
     // Load ppm texture
     inline void load(string p) {
         auto b = fs::path(p);
         auto pc = b.replace_extension(".ppm").string();
-        auto pa = (b.parent_path() /
-            fs::path(b.stem().string() + "_alpha.ppm")).string();
-        loadpxm<uint8_t>(cs, pc);
+        std::vector<uint8_t> ct;
+        float e;
+        if (!readpxm<uint8_t>(ct, pc, e)) return;
+        maxValue = std::min(std::max(int(e), 1), 255);
+        bs.resize(ct.size());
+        const size_t row = size_t(w) * 3;
+        for (int y = 0; y < h; y++)
+            std::copy(ct.begin() + (h - y - 1) * row, ct.begin() + (h - y) * row, bs.begin() + y * row);
     }
 };
 
@@ -514,120 +718,398 @@ struct ConstantTexture1f : Texture<float> {
     float getMax() const override { return value; }
 };
 
-struct BitmapTexture3f : Texture<v3f> {
-    std::unique_ptr<Tex> texturePtr;
+/**
+ * Width of the ray footprint at a hit point, in texels of a w x h texture.
+ * Uses the ratio between the UV-space and world-space areas of the hit triangle (0 if the ray has no footprint).
+ */
+inline float getTexelFootprint(const WorldData& s, const SurfaceInteraction& hit, int w, int h) {
+    if (hit.footprint <= 0.f) return 0.f;
+    const GeometryStore& g = s.geometry;
+    const size_t tri = g.getTriangle(hit.shapeID, hit.primID);
+    const v2f duv1 = g.getUV(tri, 1) - g.getUV(tri, 0);
+    const v2f duv2 = g.getUV(tri, 2) - g.getUV(tri, 0);
+    const float uvArea = std::abs(duv1.x * duv2.y - duv1.y * duv2.x) * float(w) * float(h);
+    const float worldArea = glm::length(glm::cross(g.getPosition(tri, 1) - g.getPosition(tri, 0),
+                                                   g.getPosition(tri, 2) - g.getPosition(tri, 0)));
+    return worldArea > 0.f ? hit.footprint * std::sqrt(uvArea / worldArea) : 0.f;
+}
 
-    explicit BitmapTexture3f(const Config& config, const std::string& filename) {
-        texturePtr = std::unique_ptr<Tex>(new Tex());
+/**
+ * Texture coordinates of a hit point, wrapped to [0, 1]^2.
+ */
+inline v2f getTexCoords(const WorldData& s, const SurfaceInteraction& hit) {
+    const GeometryStore& g = s.geometry;
+    const size_t tri = g.getTriangle(hit.shapeID, hit.primID);
 
-        fs::path fullpath(config.objFile);
-        if (!fullpath.is_absolute())
-            fullpath = config.tomlFile.parent_path() / fullpath;
+    v2f st = barycentric(g.getUV(tri, 0), g.getUV(tri, 1), g.getUV(tri, 2), hit.u, hit.v) + v2f(1.0, 1.0);
+    return st - glm::floor(st);
+}
 
-        fs::path file(filename);
-        if (!file.is_absolute())
-            fullpath = fullpath.parent_path() / file;
-        else
-            fullpath = file;
+/**
+ * Decoded bitmap: gamma-encoded RGB8 texels and the table decoding them.
+ * Texels are either resident (as is or BC1-compressed) or streamed from the file through a tile cache.
+ * Statistics of the full-resolution texels are computed once at decode time, along with an optional
+ * summed-area table of a level of at most SATMaxTexels texels.
+ */
+struct TextureImage {
+    enum EStorage { EResident, ECompressed, EStreamed };
+    static const int SATMaxTexels = 512 * 512;
+
+    GammaLUT lut;
+    EStorage storage{EResident};
+    MIPMap<RGB8> mipmap;
+    BC1MIPMap compressed;
+    StreamedMIPMap<RGB8> streamed;
+    v3f average, minimum, maximum;
+    SummedAreaTable sat;
+
+    int getWidth() const {
+        return storage == EResident ? mipmap.getWidth() : storage == ECompressed ? compressed.getWidth() : streamed.getWidth();
+    }
 
-        texturePtr->load(fullpath.make_preferred().string());
+    int getHeight() const {
+        return storage == EResident ? mipmap.getHeight() : storage == ECompressed ? compressed.getHeight() : streamed.getHeight();
     }
 
-    v3f getAverage() const override {
-        v3f s(0);
-        for (size_t i = 0; i < texturePtr->cs.size() / 3; i++) {
-            s += v3f(texturePtr->cs[i * 3 + 0], texturePtr->cs[i * 3 + 1], texturePtr->cs[i * 3 + 2]);
-        }
-        float scale = 1.0 / (texturePtr->cs.size() / 3.0);
-        return s * scale;
+    int getLevel(float texelFootprint) const {
+        return storage == EResident ? mipmap.getLevel(texelFootprint)
+                                    : storage == ECompressed ? compressed.getLevel(texelFootprint) : streamed.getLevel(texelFootprint);
     }
 
-    v3f getMin() const override {
-        v3f s(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-        for (size_t i = 0; i < texturePtr->cs.size() / 3; i++)
-            s = glm::min(s, v3f(texturePtr->cs[i * 3 + 0], texturePtr->cs[i * 3 + 1], texturePtr->cs[i * 3 + 2]));
-        return s;
+    RGB8 texel(int level, int x, int y) const {
+        return storage == EResident ? mipmap.texel(level, x, y)
+                                    : storage == ECompressed ? compressed.texel(level, x, y) : streamed.texel(level, x, y);
     }
 
-    v3f getMax() const override {
-        v3f s(-std::numeric_limits<float>::min(),
-              -std::numeric_limits<float>::min(),
-              -std::numeric_limits<float>::min());
-        for (size_t i = 0; i < texturePtr->cs.size() / 3; i++)
-            s = glm::max(s, v3f(texturePtr->cs[i * 3 + 0], texturePtr->cs[i * 3 + 1], texturePtr->cs[i * 3 + 2]));
-        return s;
+    RGB8 lookup(const v2f& st, int level) const {
+        return storage == EResident ? mipmap.lookup(st, level)
+                                    : storage == ECompressed ? compressed.lookup(st, level) : streamed.lookup(st, level);
     }
 
-    v3f eval(const WorldData& s, const SurfaceInteraction& hit) const override {
-        const tinyobj::shape_t& shape = s.shapes[hit.shapeID];
+    int getNbLevels() const {
+        return storage == EResident ? mipmap.getNbLevels() : storage == ECompressed ? compressed.getNbLevels() : streamed.getNbLevels();
+    }
 
-        int i0 = shape.mesh.indices[hit.primID * 3 + 0].texcoord_index;
-        int i1 = shape.mesh.indices[hit.primID * 3 + 1].texcoord_index;
-        int i2 = shape.mesh.indices[hit.primID * 3 + 2].texcoord_index;
-        v2f st0{s.attrib.texcoords[2 * i0 + 0], s.attrib.texcoords[2 * i0 + 1]};
-        v2f st1{s.attrib.texcoords[2 * i1 + 0], s.attrib.texcoords[2 * i1 + 1]};
-        v2f st2{s.attrib.texcoords[2 * i2 + 0], s.attrib.texcoords[2 * i2 + 1]};
+    /** Memory held by the image itself (streamed texels are accounted for by the tile cache). */
+    size_t getMemoryUsage() const {
+        return sat.getMemoryUsage()
+               + (storage == EResident ? mipmap.getMemoryUsage() : storage == ECompressed ? compressed.getMemoryUsage() : 0);
+    }
 
-        v2f st = barycentric(st0, st1, st2, hit.u, hit.v) + v2f(1.0, 1.0);
-        st = st - glm::floor(st);
+    /** Accumulates the statistics of a linear texel value. */
+    void addToStats(const v3f& c) {
+        average += c;
+        minimum = glm::min(minimum, c);
+        maximum = glm::max(maximum, c);
+    }
 
-        const int x = clamp(int(st.x * texturePtr->w), 0, texturePtr->w - 1);
-        const int y = clamp(int(st.y * texturePtr->h), 0, texturePtr->h - 1);
-        const int i = texturePtr->w * y + x;
+    void resetStats() {
+        average = v3f(0.f);
+        minimum = v3f(std::numeric_limits<float>::max());
+        maximum = v3f(-std::numeric_limits<float>::max());
+    }
 
-        return {texturePtr->cs[i * 3 + 0], texturePtr->cs[i * 3 + 1], texturePtr->cs[i * 3 + 2]};
-    };
+    /** Computes the statistics from the full-resolution texels (as stored, i.e. after compression). */
+    void computeStats() {
+        resetStats();
+        for (int y = 0; y < getHeight(); y++)
+            for (int x = 0; x < getWidth(); x++)
+                addToStats(lut.decode(texel(0, x, y)));
+        average /= float(getWidth()) * float(getHeight());
+    }
+
+    /** Builds the summed-area table on the finest level small enough for it. */
+    void buildSAT() {
+        int level = 0, w = getWidth(), h = getHeight();
+        while (size_t(w) * h > size_t(SATMaxTexels) && level + 1 < getNbLevels()) {
+            level++;
+            w = std::max(1, (w + 1) / 2);
+            h = std::max(1, (h + 1) / 2);
+        }
+        sat.build(w, h, [this, level](int x, int y) { return lut.decode(texel(level, x, y)); });
+    }
 };
 
-struct BitmapTexture1f : Texture<float> {
-    std::unique_ptr<Tex> texturePtr;
+/**
+ * Registry of the bitmap textures of a scene.
+ * Textures are registered by path and each file is decoded once, however many materials share it.
+ * Decoding happens on first use ("lazy"), on a pool of background threads ("async") or right away ("eager").
+ * With a texture memory budget, texels are streamed through a tile cache shared by all textures.
+ */
+class TextureLibrary {
+public:
+    typedef std::shared_future<std::shared_ptr<const TextureImage>> Handle;
 
-    explicit BitmapTexture1f(const std::string& filename) {
-        texturePtr = std::unique_ptr<Tex>(new Tex());
-        texturePtr->load(filename);
+    static TextureLibrary& get() {
+        static TextureLibrary library;
+        return library;
     }
 
-    float getAverage() const override {
-        float s(0);
-        for (size_t i = 0; i < texturePtr->cs.size(); i++) {
-            s += texturePtr->cs[i];
+    ~TextureLibrary() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
-        float scale = 1.0f / texturePtr->cs.size();
-        return s * scale;
+        wakeUp.notify_all();
+        for (std::thread& t : workers) t.join();
     }
 
-    float getMin() const override {
-        float s = std::numeric_limits<float>::max();
-        for (size_t i = 0; i < texturePtr->cs.size() / 3; i++)
-            s = min(texturePtr->cs[i], s);
-        return s;
+    /**
+     * Forgets registered textures and applies the loading settings of a scene.
+     */
+    void configure(const Config& config) {
+        std::lock_guard<std::mutex> lock(mutex);
+        textures.clear();
+        nbRequests = 0;
+        loading = config.textureLoading;
+        compression = config.textureCompression;
+        buildSAT = config.textureSAT;
+        budget = size_t(std::max(config.textureBudget, 0)) << 20;
+        tiles.clear();
+        tiles.setBudget(budget);
+        if (loading == "async" && workers.empty()) {
+            const unsigned nThreads = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned i = 0; i < nThreads; i++)
+                workers.emplace_back([this]() { work(); });
+        }
     }
 
-    float getMax() const override {
-        float s = std::numeric_limits<float>::min();
-        for (size_t i = 0; i < texturePtr->cs.size() / 3; i++)
-            s = max(texturePtr->cs[i], s);
-        return s;
+    /**
+     * Image of a texture file, shared with all previous requests for the same file.
+     */
+    Handle request(const fs::path& file) {
+        std::unique_lock<std::mutex> lock(mutex);
+        nbRequests++;
+        const std::string key = file.string();
+        auto it = textures.find(key);
+        if (it != textures.end()) return it->second;
+
+        const uint32_t id = uint32_t(textures.size());
+        Handle handle;
+        if (loading == "lazy") {
+            handle = std::async(std::launch::deferred, [this, key, id]() { return decode(key, id); }).share();
+        } else if (loading == "async") {
+            auto task = std::make_shared<std::packaged_task<std::shared_ptr<const TextureImage>()>>(
+                [this, key, id]() { return decode(key, id); });
+            handle = task->get_future().share();
+            queue.emplace_back([task]() { (*task)(); });
+            wakeUp.notify_one();
+        } else {
+            std::promise<std::shared_ptr<const TextureImage>> decoded;
+            decoded.set_value(decode(key, id));
+            handle = decoded.get_future().share();
+        }
+        textures.emplace(key, handle);
+        return handle;
     }
 
-    float eval(const WorldData& s, const SurfaceInteraction& hit) const override {
-        const tinyobj::shape_t& shape = s.shapes[hit.shapeID];
+    /**
+     * Memory held by the decoded images and the tile cache, in bytes.
+     */
+    size_t getMemoryUsage() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t decoded;
+        return getResidentMemory(decoded) + tiles.getMemoryUsage();
+    }
 
-        int i0 = shape.mesh.indices[hit.primID * 3 + 0].texcoord_index;
-        int i1 = shape.mesh.indices[hit.primID * 3 + 1].texcoord_index;
-        int i2 = shape.mesh.indices[hit.primID * 3 + 2].texcoord_index;
-        v2f st0{s.attrib.texcoords[2 * i0 + 0], s.attrib.texcoords[2 * i0 + 1]};
-        v2f st1{s.attrib.texcoords[2 * i1 + 0], s.attrib.texcoords[2 * i1 + 1]};
-        v2f st2{s.attrib.texcoords[2 * i2 + 0], s.attrib.texcoords[2 * i2 + 1]};
+    void printStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (textures.empty()) return;
+        size_t decoded;
+        const size_t resident = getResidentMemory(decoded);
+        std::cout << "Textures: " << textures.size() << " files for " << nbRequests << " references, " << decoded
+                  << " decoded (" << resident / 1024 << " KB resident";
+        if (budget > 0)
+            std::cout << ", tile cache " << tiles.getMemoryUsage() / 1024 << " KB, " << tiles.getHits() << " hits, "
+                      << tiles.getMisses() << " misses";
+        std::cout << ")" << std::endl;
+    }
+
+private:
+    // Memory of the images decoded so far (the mutex must be held)
+    size_t getResidentMemory(size_t& decoded) {
+        size_t resident = 0;
+        decoded = 0;
+        for (auto& t : textures) {
+            if (t.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+            resident += t.second.get()->getMemoryUsage();
+            decoded++;
+        }
+        return resident;
+    }
+
+    // Background decoding loop of the async pool
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::shared_ptr<const TextureImage> decode(const std::string& file, uint32_t id) {
+        std::shared_ptr<TextureImage> image(new TextureImage);
+        Tex tex;
+
+        // Streamed textures only read their header here, tiles are read from the file on demand
+        const long offset = budget > 0 ? tex.readppmHeader(fs::path(file).replace_extension(".ppm").string()) : -1;
+        if (offset >= 0) {
+            std::cout << "Streaming texture : " << file << " w: " << tex.w << " h: " << tex.h << std::endl;
+            image->lut = GammaLUT(tex.maxValue);
+            image->storage = TextureImage::EStreamed;
+            const std::string ppm = fs::path(file).replace_extension(".ppm").string();
+            const int w = tex.w, h = tex.h;
+            const GammaLUT* lut = &image->lut;
+            image->streamed.init(tiles, id, w, h, [ppm, offset, w, h](int x0, int y0, int bw, int bh, size_t stride, RGB8* out) {
+                FILE* f = fopen(ppm.c_str(), "rb");
+                if (!f) return;
+                for (int y = y0; y < y0 + bh; y++) {
+                    // Rows are stored top to bottom in the file
+                    fseek(f, offset + 3 * (long(h - y - 1) * w + x0), SEEK_SET);
+                    if (fread(out + size_t(y - y0) * stride, sizeof(RGB8), bw, f) != size_t(bw)) break;
+                }
+                fclose(f);
+            }, [lut](const RGB8& a, const RGB8& b, const RGB8& c, const RGB8& d) { return lut->average(a, b, c, d); });
+
+            // Statistics from a sequential pass over the file, one row at a time
+            image->resetStats();
+            std::vector<RGB8> row(w);
+            FILE* f = fopen(ppm.c_str(), "rb");
+            if (f) {
+                fseek(f, offset, SEEK_SET);
+                for (int y = 0; y < h && fread(row.data(), sizeof(RGB8), w, f) == size_t(w); y++)
+                    for (const RGB8& c : row) image->addToStats(lut->decode(c));
+                fclose(f);
+            }
+            image->average /= float(w) * float(h);
+            if (buildSAT) image->buildSAT();
+            return image;
+        }
+
+        tex.load(file);
+        image->lut = GammaLUT(tex.maxValue);
+        const GammaLUT& lut = image->lut;
+        image->mipmap.build(tex.w, tex.h, [&tex](int x, int y) {
+            const uint8_t* c = &tex.bs[3 * (size_t(tex.w) * y + x)];
+            return RGB8{c[0], c[1], c[2]};
+        }, [&lut](const RGB8& a, const RGB8& b, const RGB8& c, const RGB8& d) { return lut.average(a, b, c, d); });
+
+        if (compression > 0 && size_t(tex.w) * tex.h >= size_t(compression)) {
+            image->compressed.build(image->mipmap);
+            image->mipmap.levels.clear();
+            image->storage = TextureImage::ECompressed;
+        }
+        image->computeStats();
+        if (buildSAT) image->buildSAT();
+        return image;
+    }
 
-        v2f st = barycentric(st0, st1, st2, hit.u, hit.v) + v2f(1.0, 1.0);
-        st = st - glm::floor(st);
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> workers;
+    bool stopping{false};
+
+    std::unordered_map<std::string, Handle> textures;
+    size_t nbRequests{0};
+    std::string loading{"async"};
+    int compression{0};
+    bool buildSAT{false};
+    size_t budget{0};
+    TileCache<RGB8> tiles;
+};
 
-        const int x = clamp(int(st.x * texturePtr->w), 0, texturePtr->w - 1);
-        const int y = clamp(int(st.y * texturePtr->h), 0, texturePtr->h - 1);
-        const int i = texturePtr->w * y + x;
+/**
+ * Bitmap RGB texture, evaluated from a shared TextureImage of the TextureLibrary.
+ * Texels stay gamma-encoded on 8 bits and are decoded through a lookup table at evaluation time.
+ */
+struct BitmapTexture3f : Texture<v3f> {
+    TextureLibrary::Handle image;
 
-        return texturePtr->cs[i];
+    explicit BitmapTexture3f(const Config& config, const std::string& filename) {
+        fs::path fullpath(config.objFile);
+        if (!fullpath.is_absolute())
+            fullpath = config.tomlFile.parent_path() / fullpath;
+
+        fs::path file(filename);
+        if (!file.is_absolute())
+            fullpath = fullpath.parent_path() / file;
+        else
+            fullpath = file;
+
+        image = TextureLibrary::get().request(fullpath.make_preferred());
+    }
+
+    /** Decoded image, waiting for (or running) its decoding on first use. */
+    const TextureImage& getImage() const { return *image.get(); }
+
+    v3f getAverage() const override { return getImage().average; }
+    v3f getMin() const override { return getImage().minimum; }
+    v3f getMax() const override { return getImage().maximum; }
+
+    /**
+     * Average over the box [st0, st1] of texture coordinates (requires the summed-area table).
+     */
+    v3f getAverage(const v2f& st0, const v2f& st1) const { return getImage().sat.boxAverage(st0, st1); }
+
+    /**
+     * Nearest texel of the MIP level matching the ray footprint.
+     * With a summed-area table, footprints wider than its texels are box-filtered instead.
+     */
+    v3f eval(const WorldData& s, const SurfaceInteraction& hit) const override {
+        const TextureImage& img = getImage();
+        const float footprint = getTexelFootprint(s, hit, img.getWidth(), img.getHeight());
+        const v2f st = getTexCoords(s, hit);
+        if (img.sat.isBuilt() && footprint * img.sat.w >= float(img.getWidth())) {
+            const v2f radius(0.5f * footprint / float(img.getWidth()), 0.5f * footprint / float(img.getHeight()));
+            return img.sat.boxAverage(st - radius, st + radius);
+        }
+        return img.lut.decode(img.lookup(st, img.getLevel(footprint)));
+    };
+};
+
+/**
+ * Bitmap scalar texture (first channel of the image), stored as gamma-encoded bytes.
+ */
+struct BitmapTexture1f : Texture<float> {
+    GammaLUT lut;
+    MIPMap<uint8_t> mipmap;
+    float average, minimum, maximum;
+
+    explicit BitmapTexture1f(const std::string& filename) {
+        Tex tex;
+        tex.load(filename);
+        lut = GammaLUT(tex.maxValue);
+        mipmap.build(tex.w, tex.h, [&tex](int x, int y) { return tex.bs[3 * (size_t(tex.w) * y + x)]; },
+                     [this](uint8_t a, uint8_t b, uint8_t c, uint8_t d) { return lut.average(a, b, c, d); });
+
+        average = 0.f;
+        minimum = std::numeric_limits<float>::max();
+        maximum = -std::numeric_limits<float>::max();
+        for (int y = 0; y < mipmap.getHeight(); y++) {
+            for (int x = 0; x < mipmap.getWidth(); x++) {
+                const float v = lut.decode(mipmap.texel(0, x, y));
+                average += v;
+                minimum = std::min(minimum, v);
+                maximum = std::max(maximum, v);
+            }
+        }
+        average /= float(mipmap.getWidth()) * float(mipmap.getHeight());
+    }
+
+    float getAverage() const override { return average; }
+    float getMin() const override { return minimum; }
+    float getMax() const override { return maximum; }
+
+    float eval(const WorldData& s, const SurfaceInteraction& hit) const override {
+        const int level = mipmap.getLevel(getTexelFootprint(s, hit, mipmap.getWidth(), mipmap.getHeight()));
+        return lut.decode(mipmap.lookup(getTexCoords(s, hit), level));
     };
 };
 
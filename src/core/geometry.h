@@ -0,0 +1,247 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/math.h>
+#include <unordered_map>
+#include "tiny_obj_loader.h"
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Precomputed shading record of a triangle.
+ * Stores the geometric normal frame, the emitter the triangle belongs to (-1 if none), and whether
+ * the triangle is flat-shaded (all vertex normals equal to the geometric normal, so Ns == Ng).
+ */
+struct TriangleRecord {
+    v3f s, t, n;
+    int emitterID;
+    bool flat;
+};
+
+/**
+ * Triangle geometry of the whole scene, compiled from the OBJ data.
+ * Positions, normals and texture coordinates are stored in separate arrays (SoA) that share
+ * a single index per triangle corner: OBJ corners with the same (v, vt, vn) triplet are welded.
+ * Triangles of all shapes are stored back to back, shape i owns triangles [shapeOffsets[i], shapeOffsets[i + 1]).
+ */
+struct GeometryStore {
+    std::vector<v3f> positions;
+    std::vector<v3f> normals;
+    std::vector<v2f> uvs;
+    std::vector<uint32_t> indices;      // 3 per triangle
+    std::vector<int> materialIDs;       // 1 per triangle
+    std::vector<size_t> shapeOffsets;   // 1 per shape, plus the total triangle count
+    std::vector<TriangleRecord> records; // 1 per triangle, optional (see buildRecords)
+
+    size_t getNbTriangles() const { return materialIDs.size(); }
+    size_t getNbTriangles(size_t shapeID) const { return shapeOffsets[shapeID + 1] - shapeOffsets[shapeID]; }
+
+    /** Global triangle index of primitive primID of a shape. */
+    size_t getTriangle(size_t shapeID, size_t primID) const { return shapeOffsets[shapeID] + primID; }
+
+    /** Vertex index of corner k (0, 1 or 2) of a triangle. */
+    uint32_t getIndex(size_t tri, int k) const { return indices[3 * tri + k]; }
+
+    const v3f& getPosition(size_t tri, int k) const { return positions[indices[3 * tri + k]]; }
+    const v3f& getNormal(size_t tri, int k) const { return normals[indices[3 * tri + k]]; }
+    const v2f& getUV(size_t tri, int k) const { return uvs[indices[3 * tri + k]]; }
+
+    /**
+     * Indexed mesh of a shape: the store vertices it uses (in order of first use) and, for each corner
+     * of its triangles, the index of its vertex in that list. Suited to per-shape index buffers.
+     */
+    void getShapeMesh(size_t shapeID, std::vector<uint32_t>& vertices, std::vector<uint32_t>& localIndices) const {
+        std::unordered_map<uint32_t, uint32_t> local;
+        const size_t first = 3 * shapeOffsets[shapeID], last = 3 * shapeOffsets[shapeID + 1];
+        vertices.clear();
+        localIndices.resize(last - first);
+        local.reserve(last - first);
+        for (size_t i = first; i < last; i++) {
+            auto it = local.emplace(indices[i], uint32_t(vertices.size())).first;
+            if (it->second == vertices.size()) vertices.push_back(indices[i]);
+            localIndices[i - first] = it->second;
+        }
+    }
+
+    /** Memory used by the store, in bytes. */
+    size_t getMemoryUsage() const {
+        return positions.size() * sizeof(v3f) + normals.size() * sizeof(v3f) + uvs.size() * sizeof(v2f)
+               + indices.size() * sizeof(uint32_t) + materialIDs.size() * sizeof(int)
+               + shapeOffsets.size() * sizeof(size_t) + records.size() * sizeof(TriangleRecord);
+    }
+
+    /**
+     * Builds the per-triangle shading records, given the emitter ID of each shape (-1 if not emissive).
+     */
+    void buildRecords(const std::vector<int>& shapeEmitterIDs) {
+        const float flatThreshold = 1.f - 1e-6f;
+        records.resize(getNbTriangles());
+        for (size_t shapeID = 0; shapeID + 1 < shapeOffsets.size(); shapeID++) {
+            for (size_t tri = shapeOffsets[shapeID]; tri < shapeOffsets[shapeID + 1]; tri++) {
+                TriangleRecord& r = records[tri];
+                const v3f& v0 = getPosition(tri, 0);
+                r.n = glm::normalize(glm::cross(getPosition(tri, 1) - v0, getPosition(tri, 2) - v0));
+                coordinateSystem(r.n, r.s, r.t);
+                r.emitterID = shapeEmitterIDs[shapeID];
+                r.flat = true;
+                for (int k = 0; k < 3; k++)
+                    r.flat &= glm::dot(glm::normalize(getNormal(tri, k)), r.n) >= flatThreshold;
+            }
+        }
+    }
+
+    /**
+     * Merges vertices whose positions, normals and texture coordinates all agree within epsilon
+     * (per component) into the first of them, and removes the vertices left unused.
+     * Candidates are found on a grid of epsilon-sized cells over the positions. Returns the number of merged vertices.
+     */
+    size_t weld(float epsilon) {
+        if (!(epsilon > 0.f) || positions.empty()) return 0;
+
+        const auto cellOf = [epsilon](const v3f& p) {
+            return glm::ivec3(int(std::floor(p.x / epsilon)), int(std::floor(p.y / epsilon)), int(std::floor(p.z / epsilon)));
+        };
+        const auto cellKey = [](const glm::ivec3& c) {
+            return (uint64_t(uint32_t(c.x) & 0x1FFFFF) << 42) | (uint64_t(uint32_t(c.y) & 0x1FFFFF) << 21)
+                   | uint64_t(uint32_t(c.z) & 0x1FFFFF);
+        };
+        const auto close = [epsilon](const v3f& a, const v3f& b) {
+            return std::abs(a.x - b.x) <= epsilon && std::abs(a.y - b.y) <= epsilon && std::abs(a.z - b.z) <= epsilon;
+        };
+
+        std::unordered_map<uint64_t, std::vector<uint32_t>> grid;
+        grid.reserve(positions.size());
+        std::vector<uint32_t> remap(positions.size());
+        std::vector<uint32_t> kept;
+        kept.reserve(positions.size());
+
+        for (uint32_t i = 0; i < uint32_t(positions.size()); i++) {
+            const glm::ivec3 cell = cellOf(positions[i]);
+            bool merged = false;
+            for (int dz = -1; dz <= 1 && !merged; dz++) {
+                for (int dy = -1; dy <= 1 && !merged; dy++) {
+                    for (int dx = -1; dx <= 1 && !merged; dx++) {
+                        auto it = grid.find(cellKey(cell + glm::ivec3(dx, dy, dz)));
+                        if (it == grid.end()) continue;
+                        for (uint32_t r : it->second) {
+                            if (close(positions[i], positions[kept[r]]) && close(normals[i], normals[kept[r]])
+                                && std::abs(uvs[i].x - uvs[kept[r]].x) <= epsilon
+                                && std::abs(uvs[i].y - uvs[kept[r]].y) <= epsilon) {
+                                remap[i] = r;
+                                merged = true;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            if (!merged) {
+                remap[i] = uint32_t(kept.size());
+                grid[cellKey(cell)].push_back(uint32_t(kept.size()));
+                kept.push_back(i);
+            }
+        }
+
+        const size_t nbMerged = positions.size() - kept.size();
+        if (nbMerged == 0) return 0;
+        for (size_t r = 0; r < kept.size(); r++) {
+            positions[r] = positions[kept[r]];
+            normals[r] = normals[kept[r]];
+            uvs[r] = uvs[kept[r]];
+        }
+        positions.resize(kept.size());
+        normals.resize(kept.size());
+        uvs.resize(kept.size());
+        positions.shrink_to_fit();
+        normals.shrink_to_fit();
+        uvs.shrink_to_fit();
+        for (uint32_t& idx : indices) idx = remap[idx];
+        return nbMerged;
+    }
+
+    /**
+     * Builds the store from tinyobj's (triangulated) shapes.
+     * Corners without a normal get the area-weighted average of the face normals around their position,
+     * corners without texture coordinates get (0, 0).
+     */
+    void build(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes) {
+        struct CornerKey {
+            int v, vt, vn;
+            bool operator==(const CornerKey& o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+        };
+        struct CornerHash {
+            size_t operator()(const CornerKey& k) const {
+                uint64_t h = uint64_t(uint32_t(k.v)) * 0x9E3779B97F4A7C15ull;
+                h ^= (uint64_t(uint32_t(k.vt)) + 0x7F4A7C15ull + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+                h ^= (uint64_t(uint32_t(k.vn)) + 0x94D049BBull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+                return size_t(h ^ (h >> 31));
+            }
+        };
+
+        positions.clear();
+        normals.clear();
+        uvs.clear();
+        indices.clear();
+        materialIDs.clear();
+        shapeOffsets.clear();
+        records.clear();
+
+        size_t nCorners = 0;
+        for (const tinyobj::shape_t& s : shapes) nCorners += s.mesh.indices.size();
+        indices.reserve(nCorners);
+        materialIDs.reserve(nCorners / 3);
+        shapeOffsets.reserve(shapes.size() + 1);
+
+        const std::vector<float>& vx = attrib.vertices;
+        const std::vector<float>& vn = attrib.normals;
+        const std::vector<float>& vt = attrib.texcoords;
+
+        std::unordered_map<CornerKey, uint32_t, CornerHash> welded;
+        welded.reserve(vx.size() / 3);
+        std::vector<uint32_t> cornerPosition;     // OBJ position index of each store vertex
+        bool missingNormals = false;
+
+        for (const tinyobj::shape_t& s : shapes) {
+            shapeOffsets.push_back(materialIDs.size());
+            for (size_t i = 0; i < s.mesh.indices.size(); i++) {
+                const tinyobj::index_t& idx = s.mesh.indices[i];
+                const CornerKey key{idx.vertex_index, idx.texcoord_index, idx.normal_index};
+                auto it = welded.find(key);
+                if (it == welded.end()) {
+                    it = welded.emplace(key, uint32_t(positions.size())).first;
+                    positions.emplace_back(vx[3 * key.v + 0], vx[3 * key.v + 1], vx[3 * key.v + 2]);
+                    if (key.vn >= 0)
+                        normals.emplace_back(vn[3 * key.vn + 0], vn[3 * key.vn + 1], vn[3 * key.vn + 2]);
+                    else {
+                        normals.emplace_back(0.f);
+                        missingNormals = true;
+                    }
+                    uvs.push_back(key.vt >= 0 ? v2f(vt[2 * key.vt + 0], vt[2 * key.vt + 1]) : v2f(0.f));
+                    cornerPosition.push_back(uint32_t(key.v));
+                }
+                indices.push_back(it->second);
+            }
+            materialIDs.insert(materialIDs.end(), s.mesh.material_ids.begin(), s.mesh.material_ids.end());
+        }
+        shapeOffsets.push_back(materialIDs.size());
+
+        if (missingNormals) {
+            std::vector<v3f> smooth(vx.size() / 3, v3f(0.f));
+            for (size_t t = 0; t < getNbTriangles(); t++) {
+                const v3f n = glm::cross(getPosition(t, 1) - getPosition(t, 0), getPosition(t, 2) - getPosition(t, 0));
+                for (int k = 0; k < 3; k++) smooth[cornerPosition[getIndex(t, k)]] += n;
+            }
+            for (size_t i = 0; i < normals.size(); i++)
+                if (normals[i] == v3f(0.f)) normals[i] = glm::normalize(smooth[cornerPosition[i]]);
+        }
+    }
+};
+
+TR_NAMESPACE_END
@@ -16,16 +16,33 @@ Integrator::Integrator(const Scene& scene) : scene(scene) { }
 bool Integrator::init() {
     rgb = std::unique_ptr<RenderBuffer>(new RenderBuffer(scene.config.width, scene.config.height));
     rgb->clear();
+    lightCache.reset();
+    if (scene.config.lightCache && !scene.lightTree && scene.emitters.size() > 1) {
+        lightCache = std::unique_ptr<LightCache>(new LightCache());
+        lightCache->build(scene.aabb, scene.config.lightCacheResolution, scene.emitterDistribution);
+    }
+#ifdef TR_ENABLE_STATS
+    cost = std::unique_ptr<RenderBuffer>(new RenderBuffer(scene.config.width, scene.config.height));
+    cost->clear();
+    RenderStats::get().reset();
+#endif
     return true;
 }
 
 void Integrator::cleanUp() {
     save();
+#ifdef TR_ENABLE_STATS
+    RenderStats::get().print();
+#endif
 }
 
 bool Integrator::save() {
     fs::path p = scene.config.tomlFile;
     saveEXR(rgb->data, p.replace_extension("exr").string(), scene.config.width, scene.config.height);
+#ifdef TR_ENABLE_STATS
+    fs::path c = p.parent_path() / fs::path(p.stem().string() + "_cost.exr");
+    saveEXR(cost->data, c.string(), scene.config.width, scene.config.height);
+#endif
     return true;
 }
 
@@ -34,8 +51,8 @@ const Emitter& Integrator::getEmitterByID(const int emitterID) const {
 }
 const BSDF* Integrator::getBSDF(const SurfaceInteraction& hit) const {
     assert(hit.shapeID < scene.worldData.shapes.size());
-    const tinyobj::shape_t& shape = scene.worldData.shapes[hit.shapeID];
-    return scene.bsdfs[shape.mesh.material_ids[hit.primID]].get();
+    const GeometryStore& g = scene.worldData.geometry;
+    return scene.bsdfs[g.materialIDs[g.getTriangle(hit.shapeID, hit.primID)]].get();
 }
 
 v3f Integrator::getEmission(const SurfaceInteraction& hit) const {
@@ -44,21 +61,159 @@ v3f Integrator::getEmission(const SurfaceInteraction& hit) const {
 }
 
 size_t Integrator::selectEmitter(float sample, float& pdf) const {
-    size_t id = size_t(sample * scene.emitters.size());
-    id = min(id, scene.emitters.size() - 1); //todo @nico : how can this happen ? (sample ==1)
-    pdf = 1.f / scene.emitters.size();
+    const size_t id = (size_t) scene.emitterDistribution.sample(sample);
+    pdf = scene.emitterDistribution.pdf(id);
     return id;
 }
 
 size_t Integrator::getEmitterIDByShapeID(size_t shapeID) const {
-    auto it = std::find_if(scene.emitters.begin(), scene.emitters.end(),
-                           [shapeID](const Emitter& s) { return s.shapeID == shapeID; });
-    assert(it != scene.emitters.end());
-    return (size_t) std::distance(scene.emitters.begin(), it);
+    assert(scene.shapeEmitterIDs[shapeID] >= 0);
+    return (size_t) scene.shapeEmitterIDs[shapeID];
+}
+
+size_t Integrator::getEmitterID(const SurfaceInteraction& hit) const {
+    const GeometryStore& g = scene.worldData.geometry;
+    if (!g.records.empty()) {
+        assert(g.records[g.getTriangle(hit.shapeID, hit.primID)].emitterID >= 0);
+        return (size_t) g.records[g.getTriangle(hit.shapeID, hit.primID)].emitterID;
+    }
+    return getEmitterIDByShapeID(hit.shapeID);
+}
+
+bool Integrator::sampleLight(Sampler& sampler, const SurfaceInteraction& hit, size_t& emitterID, v3f& n, v3f& pos,
+                             float& pdf) const {
+    // Emitter and triangle selection (the triangle is irrelevant for analytic emitters)
+    size_t tri = 0;
+    float selectionPdf;
+    if (!scene.lightTree) {
+        if (lightCache)
+            emitterID = lightCache->sample(hit.p, sampler.next(), selectionPdf);
+        else
+            emitterID = selectEmitter(sampler.next(), selectionPdf);
+        const Emitter& emitter = getEmitterByID(emitterID);
+        if (scene.worldData.shapesAnalytic[emitter.shapeID].type == AnalyticShape::ENone) {
+            const size_t primID = (size_t) emitter.faceAreaDistribution.sample(sampler.next());
+            tri = scene.worldData.geometry.getTriangle(emitter.shapeID, primID);
+            selectionPdf *= emitter.faceAreaDistribution.pdf(primID);
+        }
+    } else {
+        int id;
+        if (!scene.lightTree->sample(hit.p, hit.frameNs.n, sampler.next(), tri, id, selectionPdf)) return false;
+        emitterID = size_t(id);
+    }
+
+    const AnalyticShape& shape = scene.worldData.shapesAnalytic[getEmitterByID(emitterID).shapeID];
+    if (shape.type != AnalyticShape::ENone)
+        shape.sample(sampler.next2D(), hit.p, pos, n, pdf);
+    else
+        sampleEmitterTriangle(sampler, tri, hit, n, pos, pdf);
+    pdf *= selectionPdf;
+    return true;
+}
+
+float Integrator::getLightPdf(const SurfaceInteraction& hit, const SurfaceInteraction& lightHit) const {
+    const size_t emitterID = getEmitterID(lightHit);
+    const Emitter& emitter = getEmitterByID(emitterID);
+    const AnalyticShape& shape = scene.worldData.shapesAnalytic[emitter.shapeID];
+    const size_t tri = scene.worldData.geometry.getTriangle(lightHit.shapeID, lightHit.primID);
+    float selectionPdf;
+    if (!scene.lightTree) {
+        selectionPdf = lightCache ? lightCache->getPdf(hit.p, emitterID) : getEmitterPdf(emitter);
+        if (shape.type == AnalyticShape::ENone) selectionPdf *= emitter.faceAreaDistribution.pdf(lightHit.primID);
+    } else {
+        selectionPdf = scene.lightTree->getPmf(hit.p, hit.frameNs.n, tri);
+    }
+
+    if (shape.type != AnalyticShape::ENone)
+        return selectionPdf * shape.getPdf(hit.p, lightHit.p, lightHit.frameNs.n);
+    return selectionPdf * getEmitterTrianglePdf(tri, hit, lightHit.frameNs.n, lightHit.p);
+}
+
+namespace {
+
+/** Outside this range of solid angles (in sr), spherical triangle sampling is less robust than area sampling. */
+const float MinSphericalSampleArea = 3e-4f;
+const float MaxSphericalSampleArea = 6.22f;
+
+/**
+ * Weights of the bilinear warp applied before spherical triangle sampling so that the density follows the cosine at
+ * the shading point: corners (0,0) and (1,0) of the sample square map to v1, (0,1) to v0 and (1,1) to v2.
+ */
+void getCosineWeights(const v3f& ns, const v3f& p, const v3f& v0, const v3f& v1, const v3f& v2, float w[4]) {
+    w[0] = w[1] = std::max(0.01f, std::abs(glm::dot(ns, glm::normalize(v1 - p))));
+    w[2] = std::max(0.01f, std::abs(glm::dot(ns, glm::normalize(v0 - p))));
+    w[3] = std::max(0.01f, std::abs(glm::dot(ns, glm::normalize(v2 - p))));
+}
+
+}
+
+void Integrator::sampleEmitterTriangle(Sampler& sampler, size_t tri, const SurfaceInteraction& hit, v3f& n, v3f& pos,
+                                       float& pdf) const {
+    const GeometryStore& g = scene.worldData.geometry;
+    const v3f& v0 = g.getPosition(tri, 0);
+    const v3f& v1 = g.getPosition(tri, 1);
+    const v3f& v2 = g.getPosition(tri, 2);
+    const p2f sample = sampler.next2D();
+
+    // PDF in solid angle measure, 0 when sampling by area
+    float saPdf = 0.f;
+    v2f uv;
+    if (scene.config.emitterSampling != EAreaEmitterSampling) {
+        const float area = Warp::sphericalTriangleArea(glm::normalize(v0 - hit.p), glm::normalize(v1 - hit.p),
+                                                       glm::normalize(v2 - hit.p));
+        if (area >= MinSphericalSampleArea && area <= MaxSphericalSampleArea) {
+            p2f u = sample;
+            float warpPdf = 1.f;
+            if (scene.config.emitterSampling == EProjectedSolidAngleEmitterSampling) {
+                float w[4];
+                getCosineWeights(hit.frameNs.n, hit.p, v0, v1, v2, w);
+                u = Warp::squareToBilinear(sample, w);
+                warpPdf = Warp::squareToBilinearPdf(u, w);
+            }
+            uv = Warp::squareToSphericalTriangle(u, hit.p, v0, v1, v2, saPdf);
+            saPdf *= warpPdf;
+        }
+    }
+    if (saPdf == 0.f) uv = Warp::squareToUniformTriangle(sample);
+
+    pos = barycentric(v0, v1, v2, uv.x, uv.y);
+    n = glm::normalize(barycentric(g.getNormal(tri, 0), g.getNormal(tri, 1), g.getNormal(tri, 2), uv.x, uv.y));
+    if (saPdf > 0.f)
+        pdf = saPdf * std::abs(glm::dot(n, glm::normalize(hit.p - pos))) / glm::distance2(hit.p, pos);
+    else
+        pdf = 1.f / (0.5f * glm::length(glm::cross(v1 - v0, v2 - v0)));
+}
+
+float Integrator::getEmitterTrianglePdf(size_t tri, const SurfaceInteraction& hit, const v3f& n, const v3f& pos) const {
+    const GeometryStore& g = scene.worldData.geometry;
+    const v3f& v0 = g.getPosition(tri, 0);
+    const v3f& v1 = g.getPosition(tri, 1);
+    const v3f& v2 = g.getPosition(tri, 2);
+
+    if (scene.config.emitterSampling != EAreaEmitterSampling) {
+        const float area = Warp::sphericalTriangleArea(glm::normalize(v0 - hit.p), glm::normalize(v1 - hit.p),
+                                                       glm::normalize(v2 - hit.p));
+        if (area >= MinSphericalSampleArea && area <= MaxSphericalSampleArea) {
+            const v3f wi = glm::normalize(pos - hit.p);
+            float saPdf = 1.f / area;
+            if (scene.config.emitterSampling == EProjectedSolidAngleEmitterSampling) {
+                float w[4];
+                getCosineWeights(hit.frameNs.n, hit.p, v0, v1, v2, w);
+                saPdf *= Warp::squareToBilinearPdf(Warp::sphericalTriangleToSquare(wi, hit.p, v0, v1, v2), w);
+            }
+            return saPdf * std::abs(glm::dot(n, wi)) / glm::distance2(hit.p, pos);
+        }
+    }
+    return 1.f / (0.5f * glm::length(glm::cross(v1 - v0, v2 - v0)));
+}
+
+void Integrator::setBounceCone(Ray& ray, const SurfaceInteraction& hit, float pdf) {
+    ray.width = hit.footprint;
+    ray.spread = hit.spread + (pdf > 0.f ? 1.f / std::sqrt(pdf) : 0.f);
 }
 
 float Integrator::getEmitterPdf(const Emitter& emitter) const {
-    return 1.f / scene.emitters.size();
+    return scene.emitterDistribution.pdf(getEmitterIDByShapeID(emitter.shapeID));
 }
 
 void Integrator::sampleEmitterDirection(Sampler& sampler,
@@ -70,27 +225,13 @@ void Integrator::sampleEmitterDirection(Sampler& sampler,
 }
 
 void Integrator::sampleEmitterPosition(Sampler& sampler, const Emitter& emitter, v3f& n, v3f& pos, float& pdf) const {
-    const tinyobj::shape_t& shape = scene.worldData.shapes[emitter.shapeID];
+    const GeometryStore& g = scene.worldData.geometry;
     const size_t primID = (size_t) emitter.faceAreaDistribution.sample(sampler.next());
     const v2f uv = Warp::squareToUniformTriangle(sampler.next2D());
+    const size_t tri = g.getTriangle(emitter.shapeID, primID);
 
-    const tinyobj::index_t& idx0 = shape.mesh.indices[3 * primID + 0];
-    const tinyobj::index_t& idx1 = shape.mesh.indices[3 * primID + 1];
-    const tinyobj::index_t& idx2 = shape.mesh.indices[3 * primID + 2];
-
-    auto& vx = scene.worldData.attrib.vertices;
-    const v3f v0{vx[3 * idx0.vertex_index + 0], vx[3 * idx0.vertex_index + 1], vx[3 * idx0.vertex_index + 2]};
-    const v3f v1{vx[3 * idx1.vertex_index + 0], vx[3 * idx1.vertex_index + 1], vx[3 * idx1.vertex_index + 2]};
-    const v3f v2{vx[3 * idx2.vertex_index + 0], vx[3 * idx2.vertex_index + 1], vx[3 * idx2.vertex_index + 2]};
-
-    pos = barycentric(v0, v1, v2, uv.x, uv.y);
-
-    auto& ns = scene.worldData.attrib.normals;
-    const v3f n0{ns[3 * idx0.normal_index + 0], ns[3 * idx0.normal_index + 1], ns[3 * idx0.normal_index + 2]};
-    const v3f n1{ns[3 * idx1.normal_index + 0], ns[3 * idx1.normal_index + 1], ns[3 * idx1.normal_index + 2]};
-    const v3f n2{ns[3 * idx2.normal_index + 0], ns[3 * idx2.normal_index + 1], ns[3 * idx2.normal_index + 2]};
-
-    n = glm::normalize(barycentric(n0, n1, n2, uv.x, uv.y));
+    pos = barycentric(g.getPosition(tri, 0), g.getPosition(tri, 1), g.getPosition(tri, 2), uv.x, uv.y);
+    n = glm::normalize(barycentric(g.getNormal(tri, 0), g.getNormal(tri, 1), g.getNormal(tri, 2), uv.x, uv.y));
 
     pdf = 1.f / emitter.area;
 }
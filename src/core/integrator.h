@@ -10,6 +10,8 @@
 #include <core/platform.h>
 #include <core/core.h>
 #include <core/accel.h>
+#include <core/lighttree.h>
+#include <core/lightcache.h>
 
 TR_NAMESPACE_BEGIN
 
@@ -23,6 +25,10 @@ struct Integrator {
     const Scene& scene;
     std::vector<Sampler> samplers;
     std::unique_ptr<RenderBuffer> rgb;
+    std::unique_ptr<LightCache> lightCache;     // Emitter selection learned during the render, if enabled
+#ifdef TR_ENABLE_STATS
+    std::unique_ptr<RenderBuffer> cost;     // Per-pixel traversal cost (node visits + primitive tests per sample)
+#endif
 
     explicit Integrator(const Scene& scene);
     virtual bool init();
@@ -30,13 +36,35 @@ struct Integrator {
     virtual v3f render(const Ray&, Sampler&) const = 0;
     bool save();
 
+    /**
+     * Primary ray of sample index of pixel (x, y): starts that pixel sample in the sampler and jitters the ray.
+     */
+    typedef std::function<Ray(int x, int y, uint32_t index, Sampler& sampler)> CameraRayGenerator;
+
+    /**
+     * Renders the whole image in passes of one sample per pixel, for integrators that share samples between
+     * pixels. Returns false if the integrator renders each pixel independently, with render().
+     */
+    virtual bool renderPasses(const CameraRayGenerator&, Sampler&) { return false; }
+
+    /** Memory held by the integrator besides its render buffers. */
+    virtual size_t getMemoryUsage() const { return lightCache ? lightCache->getMemoryUsage() : 0; }
+
     /**
      * Helper functions for emitter getters.
      */
     const Emitter& getEmitterByID(int emitterID) const;
     size_t getEmitterIDByShapeID(size_t shapeID) const;
+    size_t getEmitterID(const SurfaceInteraction& hit) const;
     float getEmitterPdf(const Emitter& emitter) const;
 
+    /**
+     * Sets the cone of a ray leaving a hit point in a direction sampled with the given (solid angle) pdf.
+     * The spread grows by the angle covered by the sample, so textures are fetched from coarse MIP levels
+     * after diffuse bounces.
+     */
+    static void setBounceCone(Ray& ray, const SurfaceInteraction& hit, float pdf);
+
     /**
      * Retrieves BSDF at intersection point.
      */
@@ -49,11 +77,51 @@ struct Integrator {
 
 
     /**
-     * Selects one emitter in the scene, returns a ref on selected emitter and PDF.
-     * If only one emitter in the scene then PDF = 1.
+     * Selects one emitter in the scene with a probability proportional to its power, returns its ID and PDF.
+     * If only one emitter in the scene then PDF = 1. getEmitterPdf returns the same PDF.
      */
     size_t selectEmitter(float sample, float& pdf) const;
 
+    /**
+     * Samples a position on an emitter for a shading point: the emitter is selected by power or by the light
+     * cache (then a triangle of it by area), or a triangle by the light tree of the scene if there is one.
+     * Analytic emitters are sampled as a whole (AnalyticShape::sample), other triangles with sampleEmitterTriangle.
+     * Returns the emitter ID, the position and normal, and the PDF of the position in area measure
+     * (selection included), or false if no emitter can light the shading point.
+     */
+    bool sampleLight(Sampler& sampler, const SurfaceInteraction& hit, size_t& emitterID, v3f& n, v3f& pos, float& pdf) const;
+
+    /**
+     * PDF in area measure with which sampleLight returns the emitter point lightHit for the shading point hit.
+     */
+    float getLightPdf(const SurfaceInteraction& hit, const SurfaceInteraction& lightHit) const;
+
+    /**
+     * Feeds the light cache (if any) with the outcome of an emitter sample of sampleLight: value is the luminance
+     * of its estimate (contribution over pdf), 0 if the shadow ray was blocked.
+     */
+    void recordLight(const SurfaceInteraction& hit, size_t emitterID, float value) const {
+        if (lightCache) lightCache->record(hit.p, emitterID, value);
+    }
+
+    /** Applies what the light cache (if any) learned so far; called between pixels, never during a path sample. */
+    void updateLightCache() {
+        if (lightCache) lightCache->update();
+    }
+
+    /**
+     * Samples a point on emitter triangle tri for the shading point hit, with the emitter sampling strategy of the
+     * scene. Falls back to area sampling for triangles that subtend a tiny or huge solid angle.
+     * Returns position, interpolated normal and PDF in area measure (given the triangle).
+     */
+    void sampleEmitterTriangle(Sampler& sampler, size_t tri, const SurfaceInteraction& hit, v3f& n, v3f& pos,
+                               float& pdf) const;
+
+    /**
+     * PDF in area measure with which sampleEmitterTriangle returns the point pos of normal n on triangle tri.
+     */
+    float getEmitterTrianglePdf(size_t tri, const SurfaceInteraction& hit, const v3f& n, const v3f& pos) const;
+
     /**
      * Samples a position on a mesh.
      * Returns position and PDF in area measure.
@@ -0,0 +1,151 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include "core.h"
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Emitter selection learned per region of the scene from the shadow rays of next event estimation
+ * (in the spirit of Vévoda et al. 2018, "Bayesian Online Regression for Adaptive Direct Illumination Sampling").
+ * A uniform grid over the scene bounds: each cell records, per emitter, the contributions of the emitter samples
+ * taken from shading points inside it (zero if the shadow ray was blocked). Once a cell has MinRecords records,
+ * emitters are selected from a defensive mixture of the power distribution and of the average recorded
+ * contributions, so that emitters that never reached a cell keep a non-zero probability.
+ * The learned distribution of a cell is rebuilt each time its record count doubles. record() only queues the
+ * rebuild and update() applies it, between pixels, so that a path sample selects emitters and weights them by MIS
+ * with the same distribution.
+ */
+struct LightCache {
+    static constexpr float DefensiveFraction = 0.2f;    // Probability of selecting by power in a learned cell
+    static constexpr uint32_t MinRecords = 64;
+
+    /** Statistics of a cell, allocated on its first record. */
+    struct Cell {
+        std::vector<float> sum;         // Sum of the recorded contributions, per emitter
+        std::vector<uint32_t> count;    // Number of records, per emitter
+        uint32_t records = 0;
+        uint32_t nextUpdate = MinRecords;
+        Distribution1D learned;         // Proportional to the average contributions, empty until MinRecords
+    };
+
+    const Distribution1D* power = nullptr;
+    AABB box;
+    int res[3];
+    v3f invCellSize;
+    std::vector<std::unique_ptr<Cell>> cells;
+    std::vector<size_t> pending;    // Cells whose learned distribution is due for a rebuild
+
+    /**
+     * Grid of resolution cells along the largest axis of bounds (cubic cells), over the emitters of the
+     * power distribution.
+     */
+    void build(const AABB& bounds, int resolution, const Distribution1D& powerDistribution) {
+        power = &powerDistribution;
+        box = bounds;
+        const v3f extent = glm::max(box.max - box.min, v3f(1e-4f));
+        const float cellSize = std::max(extent.x, std::max(extent.y, extent.z)) / float(std::max(resolution, 1));
+        for (int i = 0; i < 3; i++) {
+            res[i] = std::max(1, int(std::ceil(extent[i] / cellSize)));
+            invCellSize[i] = float(res[i]) / extent[i];
+        }
+        cells.clear();
+        cells.resize(size_t(res[0]) * res[1] * res[2]);
+        pending.clear();
+    }
+
+    size_t getCellIndex(const v3f& p) const {
+        int c[3];
+        for (int i = 0; i < 3; i++) c[i] = clamp(int((p[i] - box.min[i]) * invCellSize[i]), 0, res[i] - 1);
+        return (size_t(c[2]) * res[1] + c[1]) * res[0] + c[0];
+    }
+
+    /** Learned distribution of the cell containing p, nullptr if the cell has not learned yet. */
+    const Distribution1D* getLearned(const v3f& p) const {
+        const Cell* cell = cells[getCellIndex(p)].get();
+        return cell && cell->learned.isNormalized ? &cell->learned : nullptr;
+    }
+
+    /** Selects an emitter for shading point p, returns its ID and probability. */
+    size_t sample(const v3f& p, float sample, float& pdf) const {
+        const Distribution1D* learned = getLearned(p);
+        size_t id;
+        if (!learned) {
+            id = size_t(power->sample(sample));
+        } else if (sample < DefensiveFraction) {
+            id = size_t(power->sample(sample / DefensiveFraction));
+        } else {
+            id = size_t(learned->sample(std::min((sample - DefensiveFraction) / (1.f - DefensiveFraction),
+                                                 Sampler::OneMinusEpsilon)));
+        }
+        pdf = getPdf(p, id);
+        return id;
+    }
+
+    /** Probability with which sample selects emitter id for shading point p. */
+    float getPdf(const v3f& p, size_t id) const {
+        const Distribution1D* learned = getLearned(p);
+        if (!learned) return power->pdf(id);
+        return DefensiveFraction * power->pdf(id) + (1.f - DefensiveFraction) * learned->pdf(id);
+    }
+
+    /**
+     * Records the outcome of an emitter sample taken from shading point p: value is the luminance of the
+     * sample's estimate (BSDF, emission, geometry term and visibility over the full pdf), 0 if occluded.
+     * Times the selection probability, it estimates the contribution of emitter id alone.
+     */
+    void record(const v3f& p, size_t id, float value) {
+        const float contribution = value * getPdf(p, id);
+        const size_t index = getCellIndex(p);
+        std::unique_ptr<Cell>& cell = cells[index];
+        if (!cell) {
+            cell.reset(new Cell());
+            cell->sum.assign(power->cdf.size() - 1, 0.f);
+            cell->count.assign(power->cdf.size() - 1, 0);
+        }
+        if (!std::isfinite(contribution)) return;
+        cell->sum[id] += contribution;
+        cell->count[id]++;
+        if (++cell->records < cell->nextUpdate) return;
+
+        // Rebuild on a doubling schedule, which amortizes the rebuilds to O(1) per record
+        cell->nextUpdate *= 2;
+        pending.push_back(index);
+    }
+
+    /** Rebuilds the learned distributions queued by record(). */
+    void update() {
+        for (size_t index : pending) {
+            Cell* cell = cells[index].get();
+            Distribution1D learned;
+            float total = 0.f;
+            for (size_t i = 0; i < cell->sum.size(); i++) {
+                const float mean = cell->count[i] ? cell->sum[i] / float(cell->count[i]) : 0.f;
+                learned.add(mean);
+                total += mean;
+            }
+            if (total <= 0.f) continue;   // Nothing reached the cell yet: keep selecting by power
+            learned.normalize();
+            cell->learned = std::move(learned);
+        }
+        pending.clear();
+    }
+
+    size_t getMemoryUsage() const {
+        size_t bytes = cells.capacity() * sizeof(std::unique_ptr<Cell>) + pending.capacity() * sizeof(size_t);
+        for (const auto& cell : cells) {
+            if (!cell) continue;
+            bytes += sizeof(Cell) + cell->sum.capacity() * sizeof(float) + cell->count.capacity() * sizeof(uint32_t)
+                     + cell->learned.getMemoryUsage();
+        }
+        return bytes;
+    }
+};
+
+TR_NAMESPACE_END
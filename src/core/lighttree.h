@@ -0,0 +1,332 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include "core.h"
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Bounds of a set of emissive triangles: box, cone of normals and power (Conty Estevez and Kulla 2018,
+ * "Importance Sampling of Many Lights with Adaptive Tree Splitting").
+ * Triangles emit on the side of their normal over the hemisphere, so the emission spread is always pi / 2.
+ */
+struct LightBounds {
+    AABB box;
+    v3f axis{0.f, 0.f, 1.f};
+    float cosThetaO{1.f};   // Cosine of the spread of the normals around the axis
+    float power{0.f};
+
+    /**
+     * Upper bound of the contribution of the lights to a point p with normal n, up to a constant:
+     * power over squared distance, times the cosines at the light and at p, each taken at the smallest
+     * angle the box and the cone allow.
+     */
+    float importance(const v3f& p, const v3f& n) const {
+        if (power <= 0.f) return 0.f;
+        const v3f center = box.getCenter();
+        const float radius2 = 0.25f * glm::length2(box.max - box.min);
+        const float d2 = std::max(glm::distance2(p, center), std::sqrt(radius2));
+        const v3f wi = glm::normalize(p - center);
+
+        // Half-angle subtended by the bounding sphere of the box, pi if p is inside it
+        float sinThetaB = 0.f, cosThetaB = -1.f;
+        if (radius2 < glm::distance2(p, center)) {
+            const float sin2ThetaB = radius2 / glm::distance2(p, center);
+            sinThetaB = std::sqrt(sin2ThetaB);
+            cosThetaB = safeSqrt(1.f - sin2ThetaB);
+        }
+
+        // Light side: angle between the axis and wi, minus the cone spread and the box angle
+        const float cosThetaW = glm::dot(axis, wi);
+        const float sinThetaO = safeSqrt(1.f - cosThetaO * cosThetaO);
+        const float cosThetaX = cosSubClamped(safeSqrt(1.f - cosThetaW * cosThetaW), cosThetaW, sinThetaO, cosThetaO);
+        const float cosThetaP = cosSubClamped(safeSqrt(1.f - cosThetaX * cosThetaX), cosThetaX, sinThetaB, cosThetaB);
+        if (cosThetaP <= 0.f) return 0.f;
+
+        // Receiver side
+        float cosThetaI = 1.f;
+        if (n != v3f(0.f)) {
+            const float c = std::abs(glm::dot(wi, n));
+            cosThetaI = cosSubClamped(safeSqrt(1.f - c * c), c, sinThetaB, cosThetaB);
+        }
+        return power * cosThetaP * cosThetaI / d2;
+    }
+
+    /** Cosine of max(0, a - b) given the sines and cosines of a and b. */
+    static float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB) return 1.f;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    /**
+     * Directional measure of the bounds, used by the build: the solid angle the emission can reach.
+     */
+    float getOrientationMeasure() const {
+        const float thetaO = std::acos(clamp(cosThetaO, -1.f, 1.f));
+        const float thetaW = std::min(thetaO + float(M_PI) / 2.f, float(M_PI));
+        const float sinThetaO = safeSqrt(1.f - cosThetaO * cosThetaO);
+        return 2.f * float(M_PI) * (1.f - cosThetaO)
+               + float(M_PI) / 2.f * (2.f * thetaW * sinThetaO - std::cos(thetaO - 2.f * thetaW)
+                                      - 2.f * thetaO * sinThetaO + cosThetaO);
+    }
+
+    /** Union of two bounds, with the smallest cone containing both cones. */
+    static LightBounds merge(const LightBounds& a, const LightBounds& b) {
+        LightBounds m;
+        m.box = a.box;
+        m.box.expandBy(b.box);
+        m.power = a.power + b.power;
+
+        const float thetaA = std::acos(clamp(a.cosThetaO, -1.f, 1.f));
+        const float thetaB = std::acos(clamp(b.cosThetaO, -1.f, 1.f));
+        const float thetaD = std::acos(clamp(glm::dot(a.axis, b.axis), -1.f, 1.f));
+        if (std::min(thetaD + thetaB, float(M_PI)) <= thetaA) {
+            m.axis = a.axis;
+            m.cosThetaO = a.cosThetaO;
+        } else if (std::min(thetaD + thetaA, float(M_PI)) <= thetaB) {
+            m.axis = b.axis;
+            m.cosThetaO = b.cosThetaO;
+        } else {
+            const float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+            const v3f rotationAxis = glm::cross(a.axis, b.axis);
+            if (thetaO >= float(M_PI) || glm::length2(rotationAxis) == 0.f) {
+                m.axis = a.axis;
+                m.cosThetaO = -1.f;
+            } else {
+                m.axis = glm::normalize(glm::angleAxis(thetaO - thetaA, glm::normalize(rotationAxis)) * a.axis);
+                m.cosThetaO = std::cos(thetaO);
+            }
+        }
+        return m;
+    }
+};
+
+/**
+ * Light tree: binary BVH over the emissive triangles of the scene, with LightBounds per node.
+ * Emitters are picked per shading point by walking down the tree, choosing each child with a probability
+ * proportional to its importance for that point; each leaf is one triangle, or a whole analytic emitter
+ * (which stands for its first triangle).
+ * The probability of any triangle is recomputed by walking back up from its leaf (see getPmf).
+ */
+struct LightTree {
+    struct Node {
+        LightBounds bounds;
+        int parent;         // -1 for the root
+        uint32_t index;     // Inner node: second child (the first one follows the node). Leaf: triangle
+        int emitterID;      // Leaf: emitter of the triangle, -1 for inner nodes
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> leaves;    // Leaf of each triangle of the scene, -1 if not emissive
+
+    /**
+     * Builds the tree over the triangles of the emitters, splitting nodes by the surface area orientation
+     * heuristic (SAOH) evaluated on 12 bins along each axis.
+     */
+    void build(const WorldData& world, const std::vector<Emitter>& emitters) {
+        const GeometryStore& geometry = world.geometry;
+        nodes.clear();
+        leaves.assign(geometry.getNbTriangles(), -1);
+
+        std::vector<Primitive> primitives;
+        for (size_t e = 0; e < emitters.size(); e++) {
+            const Emitter& emitter = emitters[e];
+            const float radiance = std::max(getLuminance(emitter.getRadiance()), 0.f);
+            const AnalyticShape& shape = world.shapesAnalytic[emitter.shapeID];
+            if (shape.type != AnalyticShape::ENone) {
+                // Spheres emit in all directions, rectangles along their normal
+                Primitive prim;
+                prim.bounds.box = shape.getBounds();
+                prim.bounds.axis = shape.type == AnalyticShape::ESphere ? v3f(0.f, 0.f, 1.f) : shape.n;
+                prim.bounds.cosThetaO = shape.type == AnalyticShape::ESphere ? -1.f : 1.f;
+                prim.bounds.power = float(M_PI) * shape.getArea() * radiance;
+                prim.centroid = prim.bounds.box.getCenter();
+                prim.tri = uint32_t(geometry.getTriangle(emitter.shapeID, 0));
+                prim.emitterID = int(e);
+                primitives.push_back(prim);
+                continue;
+            }
+            for (size_t i = 0; i < geometry.getNbTriangles(emitter.shapeID); i++) {
+                const size_t tri = geometry.getTriangle(emitter.shapeID, i);
+                const v3f& v0 = geometry.getPosition(tri, 0);
+                const v3f& v1 = geometry.getPosition(tri, 1);
+                const v3f& v2 = geometry.getPosition(tri, 2);
+                const v3f cross = glm::cross(v1 - v0, v2 - v0);
+                const float area = 0.5f * glm::length(cross);
+                if (!(area > 0.f)) continue;
+
+                // Cone around the geometric normal (on the side of the vertex normals) containing the vertex normals
+                Primitive prim;
+                v3f n = cross / (2.f * area);
+                const v3f shadingSum = geometry.getNormal(tri, 0) + geometry.getNormal(tri, 1) + geometry.getNormal(tri, 2);
+                if (glm::dot(n, shadingSum) < 0.f) n = -n;
+                prim.bounds.axis = n;
+                for (int k = 0; k < 3; k++)
+                    prim.bounds.cosThetaO = std::min(prim.bounds.cosThetaO,
+                                                     glm::dot(n, glm::normalize(geometry.getNormal(tri, k))));
+                prim.bounds.box = AABB(v0);
+                prim.bounds.box.expandBy(v1);
+                prim.bounds.box.expandBy(v2);
+                prim.bounds.power = float(M_PI) * area * radiance;
+                prim.centroid = (v0 + v1 + v2) / 3.f;
+                prim.tri = uint32_t(tri);
+                prim.emitterID = int(e);
+                primitives.push_back(prim);
+            }
+        }
+        if (primitives.empty()) return;
+        nodes.reserve(2 * primitives.size() - 1);
+        buildNode(primitives, 0, primitives.size(), -1);
+    }
+
+    /**
+     * Picks an emissive triangle for a point p with normal n (n = 0 to ignore the orientation at p).
+     * Returns false if no triangle can light p.
+     */
+    bool sample(const v3f& p, const v3f& n, float u, size_t& tri, int& emitterID, float& pmf) const {
+        if (nodes.empty()) return false;
+        uint32_t node = 0;
+        pmf = 1.f;
+        while (nodes[node].emitterID < 0) {
+            const float i0 = nodes[node + 1].bounds.importance(p, n);
+            const float i1 = nodes[nodes[node].index].bounds.importance(p, n);
+            if (!(i0 + i1 > 0.f)) return false;
+            const float p0 = i0 / (i0 + i1);
+            if (u < p0) {
+                node = node + 1;
+                u = Sampler::belowOne(u / p0);
+                pmf *= p0;
+            } else {
+                node = nodes[node].index;
+                u = Sampler::belowOne((u - p0) / (1.f - p0));
+                pmf *= 1.f - p0;
+            }
+        }
+        tri = nodes[node].index;
+        emitterID = nodes[node].emitterID;
+        return pmf > 0.f;
+    }
+
+    /** Probability that sample() picks a triangle for a point p with normal n. */
+    float getPmf(const v3f& p, const v3f& n, size_t tri) const {
+        int node = leaves[tri];
+        if (node < 0) return 0.f;
+        float pmf = 1.f;
+        while (nodes[node].parent >= 0) {
+            const int parent = nodes[node].parent;
+            const float i0 = nodes[parent + 1].bounds.importance(p, n);
+            const float i1 = nodes[nodes[parent].index].bounds.importance(p, n);
+            if (!(i0 + i1 > 0.f)) return 0.f;
+            pmf *= (node == parent + 1 ? i0 : i1) / (i0 + i1);
+            node = parent;
+        }
+        return pmf;
+    }
+
+    size_t getMemoryUsage() const {
+        return nodes.capacity() * sizeof(Node) + leaves.capacity() * sizeof(int);
+    }
+
+private:
+    struct Primitive {
+        LightBounds bounds;
+        v3f centroid;
+        uint32_t tri;
+        int emitterID;
+    };
+
+    static float getSurfaceArea(const AABB& box) {
+        const v3f d = box.max - box.min;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static float getCost(const LightBounds& b, const AABB& bounds, int axis) {
+        const v3f d = bounds.max - bounds.min;
+        const float kr = std::max(d.x, std::max(d.y, d.z)) / d[axis];
+        return b.power * b.getOrientationMeasure() * kr * getSurfaceArea(b.box);
+    }
+
+    uint32_t buildNode(std::vector<Primitive>& prims, size_t begin, size_t end, int parent) {
+        const uint32_t id = uint32_t(nodes.size());
+        nodes.push_back(Node());
+        nodes[id].parent = parent;
+
+        if (end - begin == 1) {
+            nodes[id].bounds = prims[begin].bounds;
+            nodes[id].index = prims[begin].tri;
+            nodes[id].emitterID = prims[begin].emitterID;
+            leaves[prims[begin].tri] = int(id);
+            return id;
+        }
+
+        LightBounds bounds = prims[begin].bounds;
+        AABB centroids(prims[begin].centroid);
+        for (size_t i = begin + 1; i < end; i++) {
+            bounds = LightBounds::merge(bounds, prims[i].bounds);
+            centroids.expandBy(prims[i].centroid);
+        }
+
+        // Cheapest bin boundary over the three axes
+        const int nbBins = 12;
+        float bestCost = std::numeric_limits<float>::infinity();
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            const float extent = centroids.max[axis] - centroids.min[axis];
+            if (!(extent > 0.f)) continue;
+            const auto binOf = [&](const Primitive& prim) {
+                return std::min(int(nbBins * (prim.centroid[axis] - centroids.min[axis]) / extent), nbBins - 1);
+            };
+            LightBounds bins[nbBins];
+            bool used[nbBins] = {};
+            for (size_t i = begin; i < end; i++) {
+                const int b = binOf(prims[i]);
+                bins[b] = used[b] ? LightBounds::merge(bins[b], prims[i].bounds) : prims[i].bounds;
+                used[b] = true;
+            }
+            for (int split = 1; split < nbBins; split++) {
+                LightBounds below, above;
+                bool hasBelow = false, hasAbove = false;
+                for (int b = 0; b < split; b++) {
+                    if (!used[b]) continue;
+                    below = hasBelow ? LightBounds::merge(below, bins[b]) : bins[b];
+                    hasBelow = true;
+                }
+                for (int b = split; b < nbBins; b++) {
+                    if (!used[b]) continue;
+                    above = hasAbove ? LightBounds::merge(above, bins[b]) : bins[b];
+                    hasAbove = true;
+                }
+                if (!hasBelow || !hasAbove) continue;
+                const float cost = getCost(below, bounds.box, axis) + getCost(above, bounds.box, axis);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = split;
+                }
+            }
+        }
+
+        size_t mid = begin + (end - begin) / 2;
+        if (bestAxis >= 0) {
+            const float extent = centroids.max[bestAxis] - centroids.min[bestAxis];
+            const auto it = std::partition(prims.begin() + begin, prims.begin() + end, [&](const Primitive& prim) {
+                return std::min(int(nbBins * (prim.centroid[bestAxis] - centroids.min[bestAxis]) / extent), nbBins - 1) < bestBin;
+            });
+            mid = size_t(it - prims.begin());
+        }
+
+        nodes[id].bounds = bounds;
+        nodes[id].emitterID = -1;
+        buildNode(prims, begin, mid, int(id));
+        nodes[id].index = buildNode(prims, mid, end, int(id));
+        return id;
+    }
+};
+
+TR_NAMESPACE_END
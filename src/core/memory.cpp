@@ -0,0 +1,71 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/memory.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+std::atomic<uint64_t> nbAllocations{0}, nbDeallocations{0}, nbAllocatedBytes{0};
+
+void* allocate(size_t size) {
+    nbAllocations.fetch_add(1, std::memory_order_relaxed);
+    nbAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void release(void* p) {
+    if (!p) return;
+    nbDeallocations.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+}
+
+// Counting replacements of the global allocation functions (the other forms forward to these)
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+
+TR_NAMESPACE_BEGIN
+
+MemoryCounters MemoryCounters::get() {
+    MemoryCounters c;
+    c.allocations = nbAllocations.load(std::memory_order_relaxed);
+    c.deallocations = nbDeallocations.load(std::memory_order_relaxed);
+    c.allocatedBytes = nbAllocatedBytes.load(std::memory_order_relaxed);
+    c.peakRSS = 0;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) c.peakRSS = pmc.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        c.peakRSS = size_t(usage.ru_maxrss);            // bytes
+#else
+        c.peakRSS = size_t(usage.ru_maxrss) * 1024;     // kilobytes
+#endif
+    }
+#endif
+    return c;
+}
+
+TR_NAMESPACE_END
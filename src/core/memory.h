@@ -0,0 +1,62 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <iomanip>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Process-wide memory counters.
+ * Allocations are counted by the global operator new/delete replacements (see memory.cpp).
+ */
+struct MemoryCounters {
+    uint64_t allocations;       // Calls to operator new so far
+    uint64_t deallocations;     // Calls to operator delete so far
+    uint64_t allocatedBytes;    // Bytes requested from operator new so far
+    size_t peakRSS;             // Peak resident set size, in bytes (0 if unknown)
+
+    static MemoryCounters get();
+};
+
+/**
+ * Breakdown of the memory held by each subsystem, printed along with the process counters.
+ */
+struct MemoryReport {
+    std::vector<std::pair<std::string, size_t>> entries;
+
+    void add(const std::string& name, size_t bytes) { entries.emplace_back(name, bytes); }
+
+    void print(const std::string& title) const {
+        const MemoryCounters c = MemoryCounters::get();
+        size_t total = 0;
+        std::cout << "Memory " << title << ":" << std::endl;
+        std::cout << std::fixed << std::setprecision(2);
+        for (const auto& e : entries) {
+            std::cout << "  " << std::left << std::setw(16) << e.first << std::right << std::setw(10)
+                      << double(e.second) / (1024. * 1024.) << " MB" << std::endl;
+            total += e.second;
+        }
+        std::cout << "  " << std::left << std::setw(16) << "total tracked" << std::right << std::setw(10)
+                  << double(total) / (1024. * 1024.) << " MB" << std::endl;
+        std::cout << "  " << std::left << std::setw(16) << "peak RSS" << std::right << std::setw(10)
+                  << double(c.peakRSS) / (1024. * 1024.) << " MB" << std::endl;
+        std::cout << "  " << std::left << std::setw(16) << "allocations" << std::right << std::setw(10)
+                  << c.allocations << " (" << c.allocations - c.deallocations << " live, "
+                  << double(c.allocatedBytes) / (1024. * 1024.) << " MB requested)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield | std::ios::adjustfield);
+        std::cout << std::setprecision(6);
+    }
+};
+
+/** Bytes held by a vector's buffer. */
+template<class T>
+inline size_t getBufferSize(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+TR_NAMESPACE_END
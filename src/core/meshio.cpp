@@ -0,0 +1,664 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/meshio.h>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The parallel loader reuses tinyobj's parsing and triangulation helpers, so the implementation lives here
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+TR_NAMESPACE_BEGIN
+
+namespace {
+
+/**
+ * Read-only memory mapping of a whole file (plain read on platforms without mmap).
+ */
+struct MappedFile {
+    const char* data{nullptr};
+    size_t size{0};
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f) return false;
+        buffer.resize(size_t(f.tellg()));
+        f.seekg(0);
+        f.read(buffer.data(), buffer.size());
+        data = buffer.data();
+        size = buffer.size();
+        return bool(f);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) return false;
+        data = static_cast<const char*>(ptr);
+        size = size_t(st.st_size);
+        return true;
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data) munmap(const_cast<char*>(data), size);
+#endif
+    }
+};
+
+/**
+ * Loads the materials of one mtllib statement: its first file that can be read, as tinyobj::LoadObj does.
+ */
+bool loadMtlLib(tinyobj::MaterialFileReader& readMatFn, const std::string& names,
+                std::vector<tinyobj::material_t>& materials, std::map<std::string, int>& materialMap,
+                std::string& err) {
+    std::vector<std::string> filenames;
+    tinyobj::SplitString(names, ' ', filenames);
+    for (const std::string& f : filenames) {
+        std::string errMtl;
+        const bool found = readMatFn(f.c_str(), &materials, &materialMap, &errMtl);
+        err += errMtl;
+        if (found) return true;
+    }
+    err += "WARN: Failed to load material file(s). Use default material.\n";
+    return false;
+}
+
+/**
+ * Statement of an OBJ file that is replayed in order once all chunks are parsed.
+ */
+struct ObjStatement {
+    char type;          // 'f' (face), 'u' (usemtl), 'm' (mtllib), 'g' (group), 'o' (object), 's' (smoothing)
+    int arg;            // faces: first corner, names: string index, smoothing: group ID
+    int nCorners;       // faces: number of corners
+    int nv, nvt, nvn;   // faces: attributes parsed so far in the chunk (resolves relative indices)
+};
+
+/**
+ * Line-aligned range of an OBJ file and everything parsed from it.
+ */
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    std::vector<tinyobj::real_t> v, vn, vt, vc;
+    std::vector<int> corners;               // Raw v/vt/vn indices of face corners (0 if absent)
+    std::vector<ObjStatement> statements;
+    std::vector<std::string> strings;
+    std::string err;
+};
+
+/**
+ * Parses a v, v/vt, v//vn or v/vt/vn triplet without resolving it (resolution needs the global counts).
+ */
+inline bool parseRawTriple(const char** token, int* raw) {
+    raw[0] = atoi(*token);
+    raw[1] = raw[2] = 0;
+    if (raw[0] == 0) return false;
+    (*token) += strcspn(*token, "/ \t\r");
+    if ((*token)[0] != '/') return true;
+    (*token)++;
+
+    if ((*token)[0] == '/') {
+        (*token)++;
+        raw[2] = atoi(*token);
+        (*token) += strcspn(*token, "/ \t\r");
+        return raw[2] != 0;
+    }
+
+    raw[1] = atoi(*token);
+    if (raw[1] == 0) return false;
+    (*token) += strcspn(*token, "/ \t\r");
+    if ((*token)[0] != '/') return true;
+    (*token)++;
+    raw[2] = atoi(*token);
+    (*token) += strcspn(*token, "/ \t\r");
+    return raw[2] != 0;
+}
+
+/**
+ * Resolves a raw OBJ index (1-based, or negative relative to the attributes read so far).
+ */
+inline int resolveIndex(int raw, int count) {
+    if (raw > 0) return raw - 1;
+    if (raw < 0) return count + raw;
+    return -1;
+}
+
+void parseChunk(ObjChunk& c) {
+    std::string linebuf;
+    const char* p = c.begin;
+    while (p < c.end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', size_t(c.end - p)));
+        if (!eol) eol = c.end;
+        linebuf.assign(p, eol);
+        p = eol + 1;
+
+        if (!linebuf.empty() && linebuf.back() == '\r') linebuf.pop_back();
+        if (linebuf.empty()) continue;
+
+        const char* token = linebuf.c_str();
+        token += strspn(token, " \t");
+        if (token[0] == '\0' || token[0] == '#') continue;
+
+        // Vertex attributes
+        if (token[0] == 'v' && IS_SPACE(token[1])) {
+            token += 2;
+            tinyobj::real_t x, y, z, r, g, b;
+            tinyobj::parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+            c.v.push_back(x);
+            c.v.push_back(y);
+            c.v.push_back(z);
+            c.vc.push_back(r);
+            c.vc.push_back(g);
+            c.vc.push_back(b);
+            continue;
+        }
+        if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])) {
+            token += 3;
+            tinyobj::real_t x, y, z;
+            tinyobj::parseReal3(&x, &y, &z, &token);
+            c.vn.push_back(x);
+            c.vn.push_back(y);
+            c.vn.push_back(z);
+            continue;
+        }
+        if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])) {
+            token += 3;
+            tinyobj::real_t x, y;
+            tinyobj::parseReal2(&x, &y, &token);
+            c.vt.push_back(x);
+            c.vt.push_back(y);
+            continue;
+        }
+
+        // Face
+        if (token[0] == 'f' && IS_SPACE(token[1])) {
+            token += 2;
+            token += strspn(token, " \t");
+            ObjStatement s{'f', int(c.corners.size() / 3), 0,
+                           int(c.v.size() / 3), int(c.vt.size() / 2), int(c.vn.size() / 3)};
+            while (!IS_NEW_LINE(token[0])) {
+                int raw[3];
+                if (!parseRawTriple(&token, raw)) {
+                    c.err = "Failed parse `f' line(e.g. zero value for face index).\n";
+                    return;
+                }
+                c.corners.insert(c.corners.end(), raw, raw + 3);
+                s.nCorners++;
+                token += strspn(token, " \t\r");
+            }
+            c.statements.push_back(s);
+            continue;
+        }
+
+        // Material, group and object statements
+        if ((0 == strncmp(token, "usemtl", 6) || 0 == strncmp(token, "mtllib", 6)) && IS_SPACE(token[6])) {
+            c.statements.push_back(ObjStatement{token[0] == 'u' ? 'u' : 'm', int(c.strings.size()), 0, 0, 0, 0});
+            c.strings.emplace_back(token + 7);
+            continue;
+        }
+        if (token[0] == 'g' && IS_SPACE(token[1])) {
+            // names[0] is 'g' itself, the group name is the second token
+            tinyobj::parseString(&token);
+            token += strspn(token, " \t\r");
+            c.statements.push_back(ObjStatement{'g', int(c.strings.size()), 0, 0, 0, 0});
+            c.strings.emplace_back(IS_NEW_LINE(token[0]) ? "" : tinyobj::parseString(&token));
+            continue;
+        }
+        if (token[0] == 'o' && IS_SPACE(token[1])) {
+            c.statements.push_back(ObjStatement{'o', int(c.strings.size()), 0, 0, 0, 0});
+            c.strings.emplace_back(token + 2);
+            continue;
+        }
+
+        // Smoothing group
+        if (token[0] == 's' && IS_SPACE(token[1])) {
+            token += 2;
+            token += strspn(token, " \t");
+            if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n') continue;
+            int id = 0;
+            if (strlen(token) >= 3) {
+                if (token[0] != 'o' || token[1] != 'f' || token[2] != 'f') continue;
+            } else {
+                id = std::max(0, tinyobj::parseInt(&token));
+            }
+            c.statements.push_back(ObjStatement{'s', id, 0, 0, 0, 0});
+            continue;
+        }
+
+        // Ignore unknown statements (and subdivision tags)
+    }
+}
+
+/**
+ * Parses an OBJ file with one chunk per thread, then replays its statements in order
+ * through tinyobj's own shape export (and triangulation).
+ */
+bool parseOBJ(const std::string& filename, const std::string& mtlBaseDir, WorldData& worldData, std::string& err) {
+    MappedFile file;
+    if (!file.open(filename)) return false;
+
+    const size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t minChunkSize = 1 << 16;
+    const size_t nChunks = std::max(size_t(1), std::min(4 * nThreads, file.size / minChunkSize));
+
+    // Split file in line-aligned chunks
+    std::vector<ObjChunk> chunks(nChunks);
+    const char* end = file.data + file.size;
+    const char* p = file.data;
+    for (size_t i = 0; i < nChunks; i++) {
+        chunks[i].begin = p;
+        if (i + 1 < nChunks) {
+            p = std::max(p, file.data + file.size * (i + 1) / nChunks);
+            const char* eol = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+            p = eol ? eol + 1 : end;
+        } else {
+            p = end;
+        }
+        chunks[i].end = p;
+    }
+
+    // Parse chunks in parallel
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextChunk{0};
+    for (size_t t = 0; t < std::min(nThreads, nChunks); t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = nextChunk++; i < nChunks; i = nextChunk++)
+                parseChunk(chunks[i]);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    for (const ObjChunk& c : chunks) {
+        if (!c.err.empty()) {
+            err = c.err;
+            return false;
+        }
+    }
+
+    // Gather vertex attributes
+    tinyobj::attrib_t& attrib = worldData.attrib;
+    attrib = tinyobj::attrib_t();
+    std::vector<size_t> vBase(nChunks), vtBase(nChunks), vnBase(nChunks);
+    size_t nv = 0, nvt = 0, nvn = 0;
+    for (size_t i = 0; i < nChunks; i++) {
+        vBase[i] = nv;
+        vtBase[i] = nvt;
+        vnBase[i] = nvn;
+        nv += chunks[i].v.size();
+        nvt += chunks[i].vt.size();
+        nvn += chunks[i].vn.size();
+    }
+    attrib.vertices.reserve(nv);
+    attrib.colors.reserve(nv);
+    attrib.texcoords.reserve(nvt);
+    attrib.normals.reserve(nvn);
+    for (ObjChunk& c : chunks) {
+        attrib.vertices.insert(attrib.vertices.end(), c.v.begin(), c.v.end());
+        attrib.colors.insert(attrib.colors.end(), c.vc.begin(), c.vc.end());
+        attrib.texcoords.insert(attrib.texcoords.end(), c.vt.begin(), c.vt.end());
+        attrib.normals.insert(attrib.normals.end(), c.vn.begin(), c.vn.end());
+        std::vector<tinyobj::real_t>().swap(c.v);
+        std::vector<tinyobj::real_t>().swap(c.vc);
+    }
+
+    // Replay statements (same state machine as tinyobj::LoadObj)
+    std::vector<tinyobj::shape_t>& shapes = worldData.shapes;
+    shapes.clear();
+    worldData.materials.clear();
+    tinyobj::MaterialFileReader readMatFn(mtlBaseDir);
+    std::map<std::string, int> materialMap;
+    std::vector<tinyobj::tag_t> tags;
+    std::vector<tinyobj::face_t> faceGroup;
+    tinyobj::shape_t shape;
+    std::string name;
+    int material = -1;
+    unsigned int smoothingID = 0;
+
+    for (size_t i = 0; i < nChunks; i++) {
+        const ObjChunk& c = chunks[i];
+        for (const ObjStatement& s : c.statements) {
+            if (s.type == 'f') {
+                const int vCount = int(vBase[i] / 3) + s.nv;
+                const int vtCount = int(vtBase[i] / 2) + s.nvt;
+                const int vnCount = int(vnBase[i] / 3) + s.nvn;
+                tinyobj::face_t face;
+                face.smoothing_group_id = smoothingID;
+                face.vertex_indices.reserve(size_t(s.nCorners));
+                for (int k = 0; k < s.nCorners; k++) {
+                    const int* raw = &c.corners[3 * (s.arg + k)];
+                    face.vertex_indices.emplace_back(resolveIndex(raw[0], vCount),
+                                                     resolveIndex(raw[1], vtCount),
+                                                     resolveIndex(raw[2], vnCount));
+                }
+                faceGroup.push_back(std::move(face));
+            } else if (s.type == 'u') {
+                auto it = materialMap.find(c.strings[s.arg]);
+                const int newMaterial = it != materialMap.end() ? it->second : -1;
+                if (newMaterial != material) {
+                    tinyobj::exportFaceGroupToShape(&shape, faceGroup, tags, material, name, true, attrib.vertices);
+                    faceGroup.clear();
+                    material = newMaterial;
+                }
+            } else if (s.type == 'm') {
+                loadMtlLib(readMatFn, c.strings[s.arg], worldData.materials, materialMap, err);
+            } else if (s.type == 'g') {
+                tinyobj::exportFaceGroupToShape(&shape, faceGroup, tags, material, name, true, attrib.vertices);
+                if (!shape.mesh.indices.empty()) shapes.push_back(shape);
+                shape = tinyobj::shape_t();
+                faceGroup.clear();
+                name = c.strings[s.arg];
+            } else if (s.type == 'o') {
+                if (tinyobj::exportFaceGroupToShape(&shape, faceGroup, tags, material, name, true, attrib.vertices))
+                    shapes.push_back(shape);
+                faceGroup.clear();
+                shape = tinyobj::shape_t();
+                name = c.strings[s.arg];
+            } else if (s.type == 's') {
+                smoothingID = (unsigned int) s.arg;
+            }
+        }
+    }
+
+    if (tinyobj::exportFaceGroupToShape(&shape, faceGroup, tags, material, name, true, attrib.vertices)
+        || !shape.mesh.indices.empty())
+        shapes.push_back(shape);
+
+    return true;
+}
+
+/**
+ * Binary mesh (.trmesh) layout: header, MTL library names, vertex attribute arrays, then per shape its name,
+ * index and per-face arrays. Every array starts on an 8-byte boundary so it can be read in place.
+ */
+const char TrMeshMagic[8] = {'T', 'R', 'M', 'E', 'S', 'H', '0', '2'};
+
+struct TrMeshHeader {
+    char magic[8];
+    uint64_t objStamp;
+    uint64_t mtlStamp;
+    uint64_t nMtlLibs;
+    uint64_t nVertices, nNormals, nTexcoords, nColors;
+    uint64_t nShapes;
+};
+
+struct TrMeshShapeHeader {
+    uint64_t nameLength;
+    uint64_t nIndices;
+    uint64_t nFaces;
+};
+
+/**
+ * File names of the mtllib statements of an OBJ file, flattened.
+ */
+std::vector<std::string> getMtlFileNames(const std::vector<std::string>& mtlLibs) {
+    std::vector<std::string> names;
+    for (const std::string& lib : mtlLibs) tinyobj::SplitString(lib, ' ', names);
+    return names;
+}
+
+/**
+ * Stamp of all material libraries referenced by the mesh (changes when any of them changes).
+ */
+uint64_t mtlStamp(const std::vector<std::string>& mtlLibs, const std::string& mtlBaseDir) {
+    uint64_t stamp = 0;
+    for (const std::string& name : getMtlFileNames(mtlLibs))
+        stamp = stamp * 31 + getFileStamp(mtlBaseDir + name);
+    return stamp;
+}
+
+/**
+ * Arguments of the mtllib statements of an OBJ file, one entry per statement (in order).
+ */
+std::vector<std::string> findMtlLibs(const std::string& filename) {
+    std::vector<std::string> libs;
+    std::ifstream f(filename);
+    std::string line;
+    while (std::getline(f, line)) {
+        const char* token = line.c_str() + strspn(line.c_str(), " \t");
+        if (0 == strncmp(token, "mtllib", 6) && IS_SPACE(token[6])) {
+            std::string names(token + 7);
+            if (!names.empty() && names.back() == '\r') names.pop_back();
+            libs.push_back(names);
+        }
+    }
+    return libs;
+}
+
+struct TrMeshWriter {
+    std::ofstream out;
+
+    template<class T>
+    void write(const T* data, size_t n) {
+        out.write(reinterpret_cast<const char*>(data), std::streamsize(sizeof(T) * n));
+        const size_t pad = (8 - (sizeof(T) * n) % 8) % 8;
+        const char zeros[8] = {};
+        out.write(zeros, std::streamsize(pad));
+    }
+};
+
+struct TrMeshReader {
+    const char* p;
+    const char* end;
+
+    template<class T>
+    bool read(std::vector<T>& v, size_t n) {
+        const size_t bytes = sizeof(T) * n;
+        if (size_t(end - p) < bytes) return false;
+        const T* src = reinterpret_cast<const T*>(p);
+        v.assign(src, src + n);
+        p += bytes + (8 - bytes % 8) % 8;
+        return true;
+    }
+
+    template<class T>
+    bool read(T& v) {
+        if (size_t(end - p) < sizeof(T)) return false;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T) + (8 - sizeof(T) % 8) % 8;
+        return true;
+    }
+};
+
+bool writeTrMesh(const std::string& path, const WorldData& worldData,
+                 const std::vector<std::string>& mtlLibs, uint64_t objStamp, uint64_t mtlStamp) {
+    const std::string tmp = path + ".tmp";
+    TrMeshWriter w;
+    w.out.open(tmp, std::ios::binary);
+    if (!w.out) return false;
+
+    const tinyobj::attrib_t& a = worldData.attrib;
+    TrMeshHeader header{};
+    memcpy(header.magic, TrMeshMagic, sizeof(TrMeshMagic));
+    header.objStamp = objStamp;
+    header.mtlStamp = mtlStamp;
+    header.nMtlLibs = mtlLibs.size();
+    header.nVertices = a.vertices.size();
+    header.nNormals = a.normals.size();
+    header.nTexcoords = a.texcoords.size();
+    header.nColors = a.colors.size();
+    header.nShapes = worldData.shapes.size();
+    w.write(&header, 1);
+
+    for (const std::string& lib : mtlLibs) {
+        const uint64_t n = lib.size();
+        w.write(&n, 1);
+        w.write(lib.data(), lib.size());
+    }
+
+    w.write(a.vertices.data(), a.vertices.size());
+    w.write(a.normals.data(), a.normals.size());
+    w.write(a.texcoords.data(), a.texcoords.size());
+    w.write(a.colors.data(), a.colors.size());
+
+    for (const tinyobj::shape_t& s : worldData.shapes) {
+        TrMeshShapeHeader sh{s.name.size(), s.mesh.indices.size(), s.mesh.material_ids.size()};
+        w.write(&sh, 1);
+        w.write(s.name.data(), s.name.size());
+        w.write(s.mesh.indices.data(), s.mesh.indices.size());
+        w.write(s.mesh.num_face_vertices.data(), s.mesh.num_face_vertices.size());
+        w.write(s.mesh.material_ids.data(), s.mesh.material_ids.size());
+        w.write(s.mesh.smoothing_group_ids.data(), s.mesh.smoothing_group_ids.size());
+    }
+
+    w.out.close();
+    if (!w.out) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    std::remove(path.c_str());
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool readTrMesh(const std::string& path, const std::string& mtlBaseDir, uint64_t objStamp,
+                WorldData& worldData, std::string& err) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+
+    TrMeshReader r{file.data, file.data + file.size};
+    TrMeshHeader header;
+    if (!r.read(header) || memcmp(header.magic, TrMeshMagic, sizeof(TrMeshMagic)) != 0
+        || header.objStamp != objStamp)
+        return false;
+
+    std::vector<std::string> mtlLibs(header.nMtlLibs);
+    for (std::string& lib : mtlLibs) {
+        uint64_t n;
+        std::vector<char> chars;
+        if (!r.read(n) || !r.read(chars, n)) return false;
+        lib.assign(chars.begin(), chars.end());
+    }
+    if (header.mtlStamp != mtlStamp(mtlLibs, mtlBaseDir)) return false;
+
+    tinyobj::attrib_t& a = worldData.attrib;
+    if (!r.read(a.vertices, header.nVertices) || !r.read(a.normals, header.nNormals)
+        || !r.read(a.texcoords, header.nTexcoords) || !r.read(a.colors, header.nColors))
+        return false;
+
+    worldData.shapes.resize(header.nShapes);
+    for (tinyobj::shape_t& s : worldData.shapes) {
+        TrMeshShapeHeader sh;
+        std::vector<char> name;
+        if (!r.read(sh) || !r.read(name, sh.nameLength)
+            || !r.read(s.mesh.indices, sh.nIndices)
+            || !r.read(s.mesh.num_face_vertices, sh.nFaces)
+            || !r.read(s.mesh.material_ids, sh.nFaces)
+            || !r.read(s.mesh.smoothing_group_ids, sh.nFaces))
+            return false;
+        s.name.assign(name.begin(), name.end());
+    }
+
+    // Materials are small, parse them from their text files
+    tinyobj::MaterialFileReader readMatFn(mtlBaseDir);
+    std::map<std::string, int> materialMap;
+    worldData.materials.clear();
+    for (const std::string& lib : mtlLibs)
+        loadMtlLib(readMatFn, lib, worldData.materials, materialMap, err);
+    return true;
+}
+
+}
+
+namespace {
+
+std::string getMtlBaseDir(const fs::path& objFile) {
+    std::string mtlBaseDir = objFile.parent_path().string();
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (!mtlBaseDir.empty() && mtlBaseDir.back() != dirsep)
+        mtlBaseDir += dirsep;
+    return mtlBaseDir;
+}
+
+}
+
+std::vector<fs::path> getMaterialFiles(const fs::path& objFile) {
+    std::vector<fs::path> files;
+    const std::string mtlBaseDir = getMtlBaseDir(objFile);
+    for (const std::string& name : getMtlFileNames(findMtlLibs(objFile.string())))
+        files.emplace_back(mtlBaseDir + name);
+    return files;
+}
+
+bool loadMaterials(const fs::path& objFile, std::vector<tinyobj::material_t>& materials, std::string& err) {
+    tinyobj::MaterialFileReader readMatFn(getMtlBaseDir(objFile));
+    std::map<std::string, int> materialMap;
+    materials.clear();
+    bool found = true;
+    for (const std::string& lib : findMtlLibs(objFile.string()))
+        found &= loadMtlLib(readMatFn, lib, materials, materialMap, err);
+    return found;
+}
+
+uint64_t getFileStamp(const fs::path& file) {
+    struct stat st;
+    if (stat(file.string().c_str(), &st) != 0) return 0;
+#if defined(__APPLE__)
+    const uint64_t ns = uint64_t(st.st_mtimespec.tv_nsec);
+#elif defined(__linux__)
+    const uint64_t ns = uint64_t(st.st_mtim.tv_nsec);
+#else
+    const uint64_t ns = 0;
+#endif
+    return uint64_t(st.st_size) * 0x9E3779B97F4A7C15ull ^ (uint64_t(st.st_mtime) * 1000000000ull + ns);
+}
+
+bool loadMesh(const fs::path& objFile, WorldData& worldData, std::string& err, bool useCache) {
+    const std::string filename = objFile.string();
+    const std::string mtlBaseDir = getMtlBaseDir(objFile);
+
+    const uint64_t objStamp = getFileStamp(objFile);
+    if (objStamp == 0) {
+        err = "Cannot open file [" + filename + "]\n";
+        return false;
+    }
+
+    fs::path cacheFile = objFile;
+    cacheFile.replace_extension(".trmesh");
+
+    if (useCache && readTrMesh(cacheFile.string(), mtlBaseDir, objStamp, worldData, err)) {
+        std::cout << "Loaded binary mesh " << cacheFile.string() << std::endl;
+        return true;
+    }
+
+    if (!parseOBJ(filename, mtlBaseDir, worldData, err))
+        return false;
+
+    if (useCache) {
+        const std::vector<std::string> mtlLibs = findMtlLibs(filename);
+        if (writeTrMesh(cacheFile.string(), worldData, mtlLibs, objStamp, mtlStamp(mtlLibs, mtlBaseDir)))
+            std::cout << "Wrote binary mesh " << cacheFile.string() << std::endl;
+        else
+            std::cout << "Warning: could not write binary mesh " << cacheFile.string() << std::endl;
+    }
+    return true;
+}
+
+TR_NAMESPACE_END
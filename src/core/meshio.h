@@ -0,0 +1,37 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/core.h>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Loads a Wavefront OBJ file (and its MTL libraries) into the world data.
+ * The file is parsed in line-aligned chunks on all cores and produces the same data as tinyobj::LoadObj.
+ * If useCache is set, a binary copy of the geometry (.trmesh) is written next to the OBJ file on first load
+ * and memory-mapped on subsequent loads, as long as the OBJ and MTL files did not change.
+ */
+bool loadMesh(const fs::path& objFile, WorldData& worldData, std::string& err, bool useCache);
+
+/**
+ * Material libraries (MTL files) referenced by an OBJ file.
+ */
+std::vector<fs::path> getMaterialFiles(const fs::path& objFile);
+
+/**
+ * Re-reads only the materials of an OBJ file from its material libraries.
+ */
+bool loadMaterials(const fs::path& objFile, std::vector<tinyobj::material_t>& materials, std::string& err);
+
+/**
+ * Stamp of a file that changes whenever it is modified (size and modification time, 0 if missing).
+ */
+uint64_t getFileStamp(const fs::path& file);
+
+TR_NAMESPACE_END
@@ -11,6 +11,9 @@
 #include <algorithm>
 #include <random>
 #include <memory>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #pragma warning(push, 0)
 //#define GLM_FORCE_INLINE
@@ -7,7 +7,12 @@
 
 #include <core/core.h>
 #include <core/accel.h>
+#include <core/lighttree.h>
+#include <core/meshio.h>
 #include <core/renderer.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <GL/glew.h>
 
 #ifdef __APPLE__
@@ -39,6 +44,7 @@
 #include <integrators/direct.h>
 
 #include <integrators/path.h>
+#include <integrators/restir.h>
 #include <renderpasses/gi.h>
 #include <bsdfs/mixture.h>
 
@@ -74,31 +80,42 @@ bool Renderer::init(const bool isRealTime, bool nogui) {
         bool succ = renderpass.get()->initOpenGL(scene.config.width, scene.config.height);
         if (!succ) return false;
 
-        return renderpass->init(scene.config);
+        if (!renderpass->init(scene.config)) return false;
+        reportMemory("after loading");
+        return true;
     } else {
-        if (scene.config.integrator == ENormalIntegrator) {
-            integrator = std::unique_ptr<NormalIntegrator>(new NormalIntegrator(scene));
-        }
-        else if (scene.config.integrator == EAOIntegrator) {
-            integrator = std::unique_ptr<AOIntegrator>(new AOIntegrator(scene));
-        } else if (scene.config.integrator == EROIntegrator) {
-            integrator = std::unique_ptr<ROIntegrator>(new ROIntegrator(scene));
-        }
-        else if (scene.config.integrator == ESimpleIntegrator) {
-            integrator = std::unique_ptr<SimpleIntegrator>(new SimpleIntegrator(scene));
-        }
-        else if (scene.config.integrator == EDirectIntegrator) {
-            integrator = std::unique_ptr<DirectIntegrator>(new DirectIntegrator(scene));
-        }
-        else if (scene.config.integrator == EPathTracerIntegrator) {
-            integrator = std::unique_ptr<PathTracerIntegrator>(new PathTracerIntegrator(scene));
-        }
-        else {
-            throw std::runtime_error("Invalid integrator type");
-        }
+        if (!initIntegrator()) return false;
+        reportMemory("after loading");
+        return true;
+    }
+}
 
-        return integrator->init();
+bool Renderer::initIntegrator() {
+    if (scene.config.integrator == ENormalIntegrator) {
+        integrator = std::unique_ptr<NormalIntegrator>(new NormalIntegrator(scene));
     }
+    else if (scene.config.integrator == EAOIntegrator) {
+        integrator = std::unique_ptr<AOIntegrator>(new AOIntegrator(scene));
+    } else if (scene.config.integrator == EROIntegrator) {
+        integrator = std::unique_ptr<ROIntegrator>(new ROIntegrator(scene));
+    }
+    else if (scene.config.integrator == ESimpleIntegrator) {
+        integrator = std::unique_ptr<SimpleIntegrator>(new SimpleIntegrator(scene));
+    }
+    else if (scene.config.integrator == EDirectIntegrator) {
+        integrator = std::unique_ptr<DirectIntegrator>(new DirectIntegrator(scene));
+    }
+    else if (scene.config.integrator == EPathTracerIntegrator) {
+        integrator = std::unique_ptr<PathTracerIntegrator>(new PathTracerIntegrator(scene));
+    }
+    else if (scene.config.integrator == EReSTIRIntegrator) {
+        integrator = std::unique_ptr<ReSTIRIntegrator>(new ReSTIRIntegrator(scene));
+    }
+    else {
+        throw std::runtime_error("Invalid integrator type");
+    }
+
+    return integrator->init();
 }
 
     void Renderer::render() {
@@ -136,7 +153,7 @@ bool Renderer::init(const bool isRealTime, bool nogui) {
             float boxWidth = scaledWidth / scene.config.width;
 
             integrator->rgb->clear();
-            Sampler sampler(260744278);
+            Sampler sampler(scene.config.sampler, scene.config.spp, 260744278, scene.config.blueNoise);
 
 
             //Not bonus loop
@@ -154,36 +171,174 @@ bool Renderer::init(const bool isRealTime, bool nogui) {
 //            }
 //        }
 
+            const Integrator::CameraRayGenerator cameraRay = [&](int x, int y, uint32_t index, Sampler& sampler) {
+                sampler.startPixelSample(x, y, index);
+                const p2f jitter = sampler.next2D();
+
+                float px = (x + jitter.x) * boxWidth;
+                float py = (y + jitter.y) * boxHeight;
+
+                //had to change this for 1 spp examples for A4 to get straight edges
+                //float px = (x + 0.5f) * boxWidth;
+                //float py = (y + 0.5f) * boxHeight;
+                glm::vec4 ray_direction = v4f(px - (scaledWidth / 2.f), (scaledHeight / 2.f) - py, -1, 1);
+                ray_direction = ray_direction * view;
+                glm::vec3 ray_direction3 = glm::normalize(v3f(ray_direction[0], ray_direction[1], ray_direction[2]));
+                Ray ray(scene.config.camera.o, ray_direction3);
+                ray.spread = boxHeight;
+                return ray;
+            };
+
+            // Integrators that reuse samples between pixels render the whole image pass by pass
+            if (integrator->renderPasses(cameraRay, sampler))
+                return;
+
             //Bonus Loop
             for(int x = 0; x < scene.config.width; ++x){
                 for(int y = 0; y < scene.config.height; ++y){
 
                     glm::vec3 cumulativeColor = v3f(0,0,0);
+#ifdef TR_ENABLE_STATS
+                    const uint64_t pixelCost = RenderStats::get().cost();
+#endif
                     for(int j = 0; j < scene.config.spp; j++) {
-
-                        float px = (x + sampler.next()) * boxWidth;
-                        float py = (y + sampler.next()) * boxHeight;
-
-                        //had to change this for 1 spp examples for A4 to get straight edges
-                        //float px = (x + 0.5f) * boxWidth;
-                        //float py = (y + 0.5f) * boxHeight;
-                        glm::vec4 ray_direction = v4f(px - (scaledWidth / 2.f), (scaledHeight / 2.f) - py, -1, 1);
-                        ray_direction = ray_direction * view;
-                        glm::vec3 ray_direction3 = glm::normalize(v3f(ray_direction[0], ray_direction[1], ray_direction[2]));
-                        Ray ray(scene.config.camera.o, ray_direction3);
-
+                        const Ray ray = cameraRay(x, y, uint32_t(j), sampler);
+                        TR_STATS_RAY(ECameraRay);
                         cumulativeColor +=  integrator->render(ray, sampler);
                     }
                     integrator->rgb->data[(scene.config.width * y) + x] = cumulativeColor / scene.config.spp;
+                    integrator->updateLightCache();
+#ifdef TR_ENABLE_STATS
+                    integrator->cost->data[(scene.config.width * y) + x] =
+                        v3f(float(RenderStats::get().cost() - pixelCost) / scene.config.spp);
+#endif
                 }
             }
         }
     }
 
+/**
+ * Watch mode (offline rendering only): polls the TOML, OBJ and MTL files and re-renders after each change,
+ * reloading as little as possible:
+ *  - TOML change keeping the [input] settings: new integrator (camera, film, renderer settings), no reload;
+ *  - MTL change: rebuilds the BSDFs of the changed materials only (and the emitters if an emission changed);
+ *  - OBJ change, or TOML change of the [input] settings: full scene reload (geometry, BVH, ...).
+ * reloadConfig re-reads the TOML file into the scene's config, it returns false (config untouched) if the file is invalid.
+ */
+void Renderer::watch(const std::function<bool()>& reloadConfig) {
+    typedef std::chrono::steady_clock Clock;
+    const Config& config = scene.config;
+
+    const auto inputSettings = [&config]() {
+        std::ostringstream s;
+        s << config.objFile << config.meshCache << config.triangleRecords << config.weldEpsilon << config.textureCompression
+          << config.textureBudget << config.textureLoading << config.textureSAT << config.lightTree
+          << config.analyticEmitters;
+        return s.str();
+    };
+    const auto watchedFiles = [this]() {
+        std::vector<fs::path> files{scene.config.tomlFile, scene.getObjFile()};
+        for (const fs::path& mtl : getMaterialFiles(scene.getObjFile())) files.push_back(mtl);
+        return files;
+    };
+    const auto stampFiles = [](const std::vector<fs::path>& files) {
+        std::vector<uint64_t> stamps;
+        for (const fs::path& f : files) stamps.push_back(getFileStamp(f));
+        return stamps;
+    };
+
+    std::vector<fs::path> files = watchedFiles();
+    std::vector<uint64_t> stamps = stampFiles(files);
+    std::cout << "Watching " << files.size() << " files for changes (Ctrl+C to quit)" << std::endl;
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::vector<uint64_t> current = stampFiles(files);
+        if (current == stamps) continue;
+
+        // Wait for the files to settle (editors may write in several steps)
+        std::vector<uint64_t> settled;
+        while ((settled = stampFiles(files)) != current) {
+            current = settled;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        const bool tomlChanged = current[0] != stamps[0];
+        const bool objChanged = current[1] != stamps[1];
+        bool mtlChanged = false;
+        for (size_t i = 2; i < files.size(); i++) mtlChanged |= current[i] != stamps[i];
+        stamps = current;
+
+        const Clock::time_point begin = Clock::now();
+        std::string update;
+        bool reload = objChanged;
+        if (tomlChanged) {
+            const std::string input = inputSettings();
+            if (!reloadConfig()) continue;
+            reload |= inputSettings() != input;
+            update = "settings";
+        }
+
+        if (!reload && mtlChanged) {
+            std::vector<tinyobj::material_t> materials;
+            std::string err;
+            if (!loadMaterials(scene.getObjFile(), materials, err)) {
+                std::cout << "Error: " << err << std::endl;
+                continue;
+            }
+            const int nbRebuilt = scene.updateMaterials(materials);
+            if (nbRebuilt < 0)
+                reload = true;
+            else
+                update += std::string(update.empty() ? "" : ", ") + std::to_string(nbRebuilt) + " material(s)";
+        }
+
+        if (reload) {
+            update = "scene reload";
+            if (!scene.load(false)) continue;
+            files = watchedFiles();
+            stamps = stampFiles(files);
+        }
+
+        if (!initIntegrator()) continue;
+        const float updateTime = std::chrono::duration<float>(Clock::now() - begin).count();
+        render();
+        integrator->cleanUp();
+        const float totalTime = std::chrono::duration<float>(Clock::now() - begin).count();
+        std::cout << "Watch: " << update << " updated in " << 1000.f * updateTime << " ms, rendered in "
+                  << 1000.f * (totalTime - updateTime) << " ms" << std::endl;
+    }
+}
+
+/**
+ * Prints the memory held by the scene and the integrator (or render pass).
+ */
+void Renderer::reportMemory(const std::string& title) const {
+    MemoryReport report;
+    scene.reportMemory(report);
+    if (integrator) {
+        size_t buffers = integrator->rgb ? integrator->rgb->getMemoryUsage() : 0;
+#ifdef TR_ENABLE_STATS
+        buffers += integrator->cost ? integrator->cost->getMemoryUsage() : 0;
+#endif
+        report.add("render buffers", buffers);
+        if (integrator->getMemoryUsage() > 0) report.add("integrator", integrator->getMemoryUsage());
+    }
+    if (renderpass) {
+        size_t mirrors = 0;
+        for (const GLObject& obj : renderpass->objects)
+            mirrors += getBufferSize(obj.vertices) + getBufferSize(obj.indices);
+        report.add("gl mirrors", mirrors);
+    }
+    report.print(title);
+}
+
 /**
  * Post-rendering step.
  */
 void Renderer::cleanUp() {
+    TextureLibrary::get().printStats();
+    reportMemory("at end of render");
     if (realTime) {
         renderpass->cleanUp();
     } else {
@@ -197,21 +352,64 @@ BSDF::BSDF(const WorldData& d, const Config& c, const size_t matID) : worldData(
 
 Scene::Scene(const Config& config) : config(config) { }
 
+/**
+ * Wall-clock timings of the scene loading stages, relative to the start of the load.
+ */
+struct LoadTimings {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage {
+        std::string name;
+        float start, duration;
+    };
+
+    Clock::time_point begin{Clock::now()};
+    std::vector<Stage> stages;
+    std::mutex mutex;
+
+    float elapsed() const { return std::chrono::duration<float>(Clock::now() - begin).count(); }
+
+    /** Runs f as a named stage. */
+    template<class F>
+    void run(const std::string& name, const F& f) {
+        const float start = elapsed();
+        f();
+        std::lock_guard<std::mutex> lock(mutex);
+        stages.push_back(Stage{name, start, elapsed() - start});
+    }
+
+    void print() const {
+        std::cout << "Scene loading stages (start + duration):" << std::endl;
+        for (const Stage& s : stages)
+            std::cout << "  " << std::left << std::setw(10) << s.name << std::fixed << std::setprecision(3)
+                      << s.start << "s + " << s.duration << "s" << std::endl;
+        std::cout << "  " << std::setw(10) << "total" << elapsed() << "s" << std::endl;
+        std::cout.unsetf(std::ios::floatfield | std::ios::adjustfield);
+    }
+};
+
+/**
+ * Loads the scene as a graph of stages, each stage starting as soon as its inputs are ready:
+ * OBJ parsing -> {BSDFs (texture decoding continues in the texture library), geometry store};
+ * geometry store -> {shape bounds, BVH}; BSDFs + geometry store -> emitters -> triangle records.
+ */
 bool Scene::load(bool isRealTime) {
-    fs::path file(config.objFile);
+    fs::path file = getObjFile();
     bool ret = false;
     std::string err;
+    LoadTimings timings;
 
-    if (!file.is_absolute())
-        file = (config.tomlFile.parent_path() / file).make_preferred();
+    // Start from an empty scene (the scene may be reloaded)
+    bvh.reset();
+    worldData = WorldData();
+    emitters.clear();
+    emitterDistribution = Distribution1D();
+    shapeEmitterIDs.clear();
+    lightTree.reset();
+    bsdfs.clear();
+    aabb.reset();
 
-    tinyobj::attrib_t* attrib_ = &worldData.attrib;
-    std::vector<tinyobj::shape_t>* shapes_ = &worldData.shapes;
-    std::vector<tinyobj::material_t>* materials_ = &worldData.materials;
-    std::string* err_ = &err;
-    const string filename_ = file.string();
-    const string mtl_basedir_ = file.make_preferred().parent_path().string();
-    ret = tinyobj::LoadObj(attrib_, shapes_, materials_, err_, filename_.c_str(), mtl_basedir_.c_str(), true);
+    timings.run("parse", [&]() { ret = loadMesh(file.make_preferred(), worldData, err, config.meshCache); });
 
     if (!err.empty()) { std::cout << "Error: " << err.c_str() << std::endl; }
     if (!ret) {
@@ -219,80 +417,343 @@ bool Scene::load(bool isRealTime) {
         return false;
     }
 
-    // Build list of BSDFs
-    bsdfs = std::vector<std::unique_ptr<BSDF>>(worldData.materials.size());
-    for (size_t i = 0; i < worldData.materials.size(); i++) {
-        if (worldData.materials[i].illum == 7)
-            bsdfs[i] = std::unique_ptr<BSDF>(new DiffuseBSDF(worldData, config, i));
-        if (worldData.materials[i].illum != 5 && worldData.materials[i].illum != 7 && worldData.materials[i].illum != 8)
-            bsdfs[i] = std::unique_ptr<BSDF>(new PhongBSDF(worldData, config, i));
-        if (worldData.materials[i].illum == 8)
-            bsdfs[i] = std::unique_ptr<BSDF>(new MixtureBSDF(worldData, config, i));
-//        if (worldData.materials[i].illum == 3) //Mirror
-//            bsdfs[i] = std::unique_ptr<BSDF>(new MirrorBSDF(worldData, config, i));
-//        if (worldData.materials[i].illum == 4) //Glass
-//            bsdfs[i] = std::unique_ptr<BSDF>(new GlassBSDF(worldData, config, i));
-//        if (worldData.materials[i].illum == 4) //Glass
-//            bsdfs[i] = std::unique_ptr<BSDF>(new MicrofacetBSDF(worldData, config, i));
-    }
+    // Build list of BSDFs (their bitmap textures are registered in the texture library)
+    TextureLibrary::get().configure(config);
+    std::future<void> bsdfsDone = std::async(std::launch::async, [&]() {
+        timings.run("bsdfs", [&]() {
+            bsdfs = std::vector<std::unique_ptr<BSDF>>(worldData.materials.size());
+            for (size_t i = 0; i < worldData.materials.size(); i++)
+                bsdfs[i] = createBSDF(i);
+        });
+    });
+
+    // Compile OBJ data into the geometry store, then release the OBJ arrays: everything reads from the store
+    GeometryStore& geometry = worldData.geometry;
+    size_t nbExactVertices = 0, nbWelded = 0;
+    timings.run("geometry", [&]() {
+        geometry.build(worldData.attrib, worldData.shapes);
+        nbExactVertices = geometry.positions.size();
+        nbWelded = geometry.weld(config.weldEpsilon);
+        worldData.attrib = tinyobj::attrib_t();
+        for (tinyobj::shape_t& shape : worldData.shapes)
+            shape.mesh = tinyobj::mesh_t();
+    });
+    buildAnalyticShapes();
 
-    // Build list of emitters (and print what has been loaded)
-    std::string nbShapes = worldData.shapes.size() > 1 ? " shapes" : " shape";
-    std::cout << "Found " << worldData.shapes.size() << nbShapes << std::endl;
+    // Build BVH
+    bvh = std::unique_ptr<TinyRender::AcceleratorBVH>(new TinyRender::AcceleratorBVH(this->worldData));
+    std::future<void> bvhDone = std::async(std::launch::async, [&]() { timings.run("bvh", [&]() { bvh->build(); }); });
+
+    // Build world AABB and shape centers
     worldData.shapesCenter.resize(worldData.shapes.size());
     worldData.shapesAABOX.resize(worldData.shapes.size());
+    std::future<void> boundsDone = std::async(std::launch::async, [&]() {
+        timings.run("bounds", [&]() {
+            for (size_t i = 0; i < worldData.shapes.size(); i++) {
+                const size_t nbTriangles = geometry.getNbTriangles(i);
+                worldData.shapesCenter[i] = v3f(0.0);
+                for (size_t t = geometry.getTriangle(i, 0); t < geometry.getTriangle(i, nbTriangles); t++) {
+                    for (int k = 0; k < 3; k++) {
+                        const v3f& p = geometry.getPosition(t, k);
+                        worldData.shapesCenter[i] += p;
+                        worldData.shapesAABOX[i].expandBy(p);
+                        aabb.expandBy(p);
+                    }
+                }
+                worldData.shapesCenter[i] /= float(3 * nbTriangles);
+            }
+        });
+    });
 
+    // Build list of emitters, their area distributions are built concurrently
+    bsdfsDone.get();
+    timings.run("emitters", [&]() { buildEmitters(); });
+
+    // Print what has been loaded
+    std::string nbShapes = worldData.shapes.size() > 1 ? " shapes" : " shape";
+    std::cout << "Found " << worldData.shapes.size() << nbShapes << std::endl;
     for (size_t i = 0; i < worldData.shapes.size(); i++) {
-        const tinyobj::shape_t& shape = worldData.shapes[i];
-        const BSDF* bsdf = bsdfs[shape.mesh.material_ids[0]].get();
-        std::cout << "Mesh " << i << ": " << shape.name << " ["
-                  << shape.mesh.indices.size() / 3 << " primitives | ";
-
-        if (bsdf->isEmissive()) {
-            Distribution1D faceAreaDistribution;
-            float shapeArea = getShapeArea(i, faceAreaDistribution);
-            emitters.emplace_back(Emitter{i, shapeArea, bsdf->emission, faceAreaDistribution});
+        const BSDF* bsdf = bsdfs[geometry.materialIDs[geometry.getTriangle(i, 0)]].get();
+        std::cout << "Mesh " << i << ": " << worldData.shapes[i].name << " ["
+                  << geometry.getNbTriangles(i) << " primitives | ";
+        if (bsdf->isEmissive())
             std::cout << "Emitter]" << std::endl;
-        } else {
+        else
             std::cout << bsdf->toString() << "]" << std::endl;
-        }
+    }
 
-        // Build world AABB and shape centers
-        worldData.shapesCenter[i] = v3f(0.0);
-        for (auto idx: shape.mesh.indices) {
-            v3f p = {worldData.attrib.vertices[3 * idx.vertex_index + 0],
-                     worldData.attrib.vertices[3 * idx.vertex_index + 1],
-                     worldData.attrib.vertices[3 * idx.vertex_index + 2]};
-            worldData.shapesCenter[i] += p;
-            worldData.shapesAABOX[i].expandBy(p);
-            aabb.expandBy(p);
-        }
-        worldData.shapesCenter[i] /= float(shape.mesh.indices.size());
+    // Precompute per-triangle shading records
+    if (config.triangleRecords) {
+        timings.run("records", [&]() { buildRecords(); });
+        std::cout << "Triangle records: " << geometry.records.size() * sizeof(TriangleRecord) / 1024 << " KB"
+                  << std::endl;
     }
 
-    // Build BVH
-    bvh = std::unique_ptr<TinyRender::AcceleratorBVH>(new TinyRender::AcceleratorBVH(this->worldData));
+    std::cout << "Welding: " << geometry.indices.size() << " corners -> " << nbExactVertices << " unique vertices";
+    if (config.weldEpsilon > 0.f)
+        std::cout << " -> " << geometry.positions.size() << " within " << config.weldEpsilon << " (" << nbWelded << " merged)";
+    std::cout << std::endl;
+    std::cout << "Geometry: " << geometry.positions.size() << " vertices, " << geometry.getNbTriangles()
+              << " triangles (" << geometry.getMemoryUsage() / 1024 << " KB)" << std::endl;
 
-    const clock_t beginBVH = clock();
-    bvh->build();
-    std::cout << "BVH built in " << float(clock() - beginBVH) / CLOCKS_PER_SEC << "s" << std::endl;
+    boundsDone.get();
+    bvhDone.get();
+    timings.print();
 
     return true;
 }
 
+fs::path Scene::getObjFile() const {
+    fs::path file(config.objFile);
+    if (!file.is_absolute())
+        file = config.tomlFile.parent_path() / file;
+    return file.make_preferred();
+}
+
+std::unique_ptr<BSDF> Scene::createBSDF(size_t matID) {
+    const int illum = worldData.materials[matID].illum;
+    if (illum == 7)
+        return std::unique_ptr<BSDF>(new DiffuseBSDF(worldData, config, matID));
+    if (illum == 8)
+        return std::unique_ptr<BSDF>(new MixtureBSDF(worldData, config, matID));
+//    if (illum == 3) //Mirror
+//        return std::unique_ptr<BSDF>(new MirrorBSDF(worldData, config, matID));
+//    if (illum == 4) //Glass
+//        return std::unique_ptr<BSDF>(new GlassBSDF(worldData, config, matID));
+//    if (illum == 4) //Glass
+//        return std::unique_ptr<BSDF>(new MicrofacetBSDF(worldData, config, matID));
+    if (illum != 5)
+        return std::unique_ptr<BSDF>(new PhongBSDF(worldData, config, matID));
+    return nullptr;
+}
+
+static bool isEmissiveMaterial(const tinyobj::material_t& m) {
+    return glm::length2(glm::make_vec3(m.emission)) > 0.f;
+}
+
+/**
+ * Sphere through the vertices of a shape, if it is a closed tessellated sphere with outward normals:
+ * vertices within 1% of the radius from the center of their box, and at least 90% of the sphere area covered.
+ */
+static bool fitSphere(const GeometryStore& g, size_t shapeID, AnalyticShape& shape) {
+    const size_t first = g.getTriangle(shapeID, 0), last = g.getTriangle(shapeID, g.getNbTriangles(shapeID));
+    if (last - first < 16) return false;
+    AABB box;
+    for (size_t t = first; t < last; t++)
+        for (int k = 0; k < 3; k++) box.expandBy(g.getPosition(t, k));
+    const v3f center = box.getCenter();
+    float radius = 0.f, area = 0.f;
+    for (size_t t = first; t < last; t++) {
+        for (int k = 0; k < 3; k++) radius += glm::distance(g.getPosition(t, k), center);
+        area += 0.5f * glm::length(glm::cross(g.getPosition(t, 1) - g.getPosition(t, 0), g.getPosition(t, 2) - g.getPosition(t, 0)));
+    }
+    radius /= float(3 * (last - first));
+    if (!(radius > 0.f)) return false;
+    for (size_t t = first; t < last; t++) {
+        for (int k = 0; k < 3; k++) {
+            const v3f d = g.getPosition(t, k) - center;
+            if (std::abs(glm::length(d) - radius) > 0.01f * radius || glm::dot(d, g.getNormal(t, k)) <= 0.f) return false;
+        }
+    }
+    if (area < 0.9f * 4.f * M_PI * radius * radius) return false;
+    shape.type = AnalyticShape::ESphere;
+    shape.p = center;
+    shape.radius = radius;
+    return true;
+}
+
+/**
+ * Rectangle made by the two triangles of a shape, if they share a diagonal, have right angles and are flat-shaded.
+ * The normal is the one of the vertices.
+ */
+static bool fitRectangle(const GeometryStore& g, size_t shapeID, AnalyticShape& shape) {
+    if (g.getNbTriangles(shapeID) != 2) return false;
+    const size_t t0 = g.getTriangle(shapeID, 0), t1 = t0 + 1;
+
+    // Corner of each triangle that is not on the shared diagonal
+    int opposite[2] = {-1, -1}, nbShared = 0;
+    for (int k = 0; k < 3; k++) {
+        bool shared = false;
+        for (int l = 0; l < 3; l++) shared |= g.getPosition(t0, k) == g.getPosition(t1, l);
+        if (shared) nbShared++;
+        else opposite[0] = k;
+    }
+    for (int l = 0; l < 3; l++) {
+        bool shared = false;
+        for (int k = 0; k < 3; k++) shared |= g.getPosition(t1, l) == g.getPosition(t0, k);
+        if (!shared) opposite[1] = l;
+    }
+    if (nbShared != 2 || opposite[0] < 0 || opposite[1] < 0) return false;
+
+    const v3f p = g.getPosition(t0, opposite[0]);
+    const v3f ex = g.getPosition(t0, (opposite[0] + 1) % 3) - p;
+    const v3f ey = g.getPosition(t0, (opposite[0] + 2) % 3) - p;
+    const float lx = glm::length(ex), ly = glm::length(ey);
+    if (!(lx > 0.f && ly > 0.f) || std::abs(glm::dot(ex, ey)) > 1e-4f * lx * ly
+        || glm::length(p + ex + ey - g.getPosition(t1, opposite[1])) > 1e-4f * (lx + ly))
+        return false;
+
+    v3f n = glm::cross(ex, ey) / (lx * ly);
+    if (glm::dot(n, g.getNormal(t0, 0)) < 0.f) n = -n;
+    for (size_t t = t0; t <= t1; t++)
+        for (int k = 0; k < 3; k++)
+            if (glm::dot(n, glm::normalize(g.getNormal(t, k))) < 0.999f) return false;
+
+    shape.type = AnalyticShape::ERectangle;
+    shape.p = p;
+    shape.ex = ex;
+    shape.ey = ey;
+    shape.n = n;
+    return true;
+}
+
+void Scene::buildAnalyticShapes() {
+    const GeometryStore& geometry = worldData.geometry;
+    worldData.shapesAnalytic.assign(worldData.shapes.size(), AnalyticShape());
+    if (!config.analyticEmitters) return;
+
+    size_t nbSpheres = 0, nbRectangles = 0;
+    for (size_t i = 0; i < worldData.shapes.size(); i++) {
+        // Emissive shapes of a single material (an analytic primitive has the material of the first triangle)
+        const size_t first = geometry.getTriangle(i, 0), last = geometry.getTriangle(i, geometry.getNbTriangles(i));
+        if (first == last || !isEmissiveMaterial(worldData.materials[geometry.materialIDs[first]])) continue;
+        if (!std::all_of(geometry.materialIDs.begin() + first, geometry.materialIDs.begin() + last,
+                         [&](int m) { return m == geometry.materialIDs[first]; }))
+            continue;
+
+        AnalyticShape& shape = worldData.shapesAnalytic[i];
+        if (fitSphere(geometry, i, shape)) nbSpheres++;
+        else if (fitRectangle(geometry, i, shape)) nbRectangles++;
+    }
+    std::cout << "Analytic emitters: " << nbSpheres << " spheres, " << nbRectangles << " rectangles" << std::endl;
+}
+
+void Scene::buildEmitters() {
+    const GeometryStore& geometry = worldData.geometry;
+    std::vector<size_t> emissiveShapes;
+    for (size_t i = 0; i < worldData.shapes.size(); i++) {
+        if (bsdfs[geometry.materialIDs[geometry.getTriangle(i, 0)]]->isEmissive())
+            emissiveShapes.push_back(i);
+    }
+
+    // Area distributions of the emissive shapes, on a bounded number of threads
+    emitters.assign(emissiveShapes.size(), Emitter());
+    const size_t nThreads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), emissiveShapes.size());
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextEmitter{0};
+    for (size_t t = 0; t < nThreads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t k = nextEmitter++; k < emissiveShapes.size(); k = nextEmitter++) {
+                const size_t i = emissiveShapes[k];
+                Distribution1D faceAreaDistribution;
+                float shapeArea = getShapeArea(i, faceAreaDistribution);
+                if (worldData.shapesAnalytic[i].type != AnalyticShape::ENone)
+                    shapeArea = worldData.shapesAnalytic[i].getArea();
+                emitters[k] = Emitter{i, shapeArea,
+                                      bsdfs[geometry.materialIDs[geometry.getTriangle(i, 0)]]->emission,
+                                      faceAreaDistribution};
+            }
+        });
+    }
+    for (std::thread& t : workers) t.join();
+
+    shapeEmitterIDs.assign(worldData.shapes.size(), -1);
+    for (size_t i = 0; i < emitters.size(); i++)
+        shapeEmitterIDs[emitters[i].shapeID] = int(i);
+
+    // Select emitters by power; uniformly if none has any (e.g. negative emission)
+    float power = 0.f;
+    for (const Emitter& e : emitters) power += std::max(getLuminance(e.getPower()), 0.f);
+    emitterDistribution = Distribution1D();
+    for (const Emitter& e : emitters)
+        emitterDistribution.add(power > 0.f ? std::max(getLuminance(e.getPower()), 0.f) : 1.f);
+    if (!emitters.empty()) {
+        emitterDistribution.normalize();
+        // The alias table also pays off below AliasThreshold here (one lookup per shadow ray), but past
+        // AliasMaxSize it would skew the selection against pdf(): leave those to the CDF
+        if (emitterDistribution.bins.empty() && emitters.size() < Distribution1D::AliasThreshold)
+            emitterDistribution.buildAliasTable();
+    }
+
+    lightTree.reset();
+    if (config.lightTree) {
+        lightTree = std::unique_ptr<LightTree>(new LightTree());
+        lightTree->build(worldData, emitters);
+    }
+}
+
+void Scene::buildRecords() {
+    worldData.geometry.buildRecords(shapeEmitterIDs);
+}
+
+/**
+ * Two materials are the same if all the parameters the BSDFs read are equal.
+ */
+static bool isSameMaterial(const tinyobj::material_t& a, const tinyobj::material_t& b) {
+    return a.name == b.name && a.illum == b.illum && std::equal(a.diffuse, a.diffuse + 3, b.diffuse)
+           && std::equal(a.specular, a.specular + 3, b.specular) && std::equal(a.emission, a.emission + 3, b.emission)
+           && std::equal(a.ambient, a.ambient + 3, b.ambient) && std::equal(a.transmittance, a.transmittance + 3, b.transmittance)
+           && a.shininess == b.shininess && a.ior == b.ior && a.dissolve == b.dissolve
+           && a.diffuse_texname == b.diffuse_texname && a.specular_texname == b.specular_texname;
+}
+
+int Scene::updateMaterials(const std::vector<tinyobj::material_t>& materials) {
+    if (materials.size() != worldData.materials.size()) return -1;
+    for (size_t i = 0; i < materials.size(); i++) {
+        if (materials[i].name != worldData.materials[i].name) return -1;
+        // Analytic emitters replace triangles in the BVH, which is only rebuilt on reload
+        if (config.analyticEmitters && isEmissiveMaterial(materials[i]) != isEmissiveMaterial(worldData.materials[i])) return -1;
+    }
+
+    int nbRebuilt = 0;
+    bool emissionChanged = false;
+    for (size_t i = 0; i < materials.size(); i++) {
+        if (isSameMaterial(materials[i], worldData.materials[i])) continue;
+        worldData.materials[i] = materials[i];
+        const bool wasEmissive = bsdfs[i] && bsdfs[i]->isEmissive();
+        const v3f oldEmission = bsdfs[i] ? bsdfs[i]->emission : v3f(0.f);
+        bsdfs[i] = createBSDF(i);
+        const bool isEmissive = bsdfs[i] && bsdfs[i]->isEmissive();
+        const v3f emission = bsdfs[i] ? bsdfs[i]->emission : v3f(0.f);
+        emissionChanged |= wasEmissive != isEmissive || (isEmissive && oldEmission != emission);
+        nbRebuilt++;
+    }
+
+    if (emissionChanged) {
+        buildEmitters();
+        if (config.triangleRecords) buildRecords();
+    }
+    return nbRebuilt;
+}
+
+void Scene::reportMemory(MemoryReport& report) const {
+    size_t obj = getBufferSize(worldData.attrib.vertices) + getBufferSize(worldData.attrib.normals)
+                 + getBufferSize(worldData.attrib.texcoords) + getBufferSize(worldData.attrib.colors)
+                 + getBufferSize(worldData.shapes) + getBufferSize(worldData.materials);
+    for (const tinyobj::shape_t& shape : worldData.shapes)
+        obj += getBufferSize(shape.mesh.indices) + getBufferSize(shape.mesh.num_face_vertices)
+               + getBufferSize(shape.mesh.material_ids) + getBufferSize(shape.mesh.smoothing_group_ids);
+    report.add("obj data", obj);
+
+    report.add("geometry", worldData.geometry.getMemoryUsage() + getBufferSize(worldData.shapesCenter)
+                           + getBufferSize(worldData.shapesAABOX) + getBufferSize(worldData.shapesAnalytic));
+    report.add("bvh", bvh ? bvh->getMemoryUsage() : 0);
+    report.add("textures", TextureLibrary::get().getMemoryUsage());
+
+    size_t distributions = emitterDistribution.getMemoryUsage() + getBufferSize(shapeEmitterIDs)
+                           + (lightTree ? lightTree->getMemoryUsage() : 0);
+    for (const Emitter& emitter : emitters) distributions += emitter.faceAreaDistribution.getMemoryUsage();
+    report.add("distributions", distributions);
+}
+
 float Scene::getShapeArea(const size_t shapeID, Distribution1D& faceAreaDistribution) {
-    const tinyobj::shape_t& s = worldData.shapes[shapeID];
-
-    for (size_t i = 0; i < s.mesh.indices.size(); i += 3) {
-        const int i0 = s.mesh.indices[i + 0].vertex_index;
-        const int i1 = s.mesh.indices[i + 1].vertex_index;
-        const int i2 = s.mesh.indices[i + 2].vertex_index;
-        const v3f v0{worldData.attrib.vertices[3 * i0 + 0], worldData.attrib.vertices[3 * i0 + 1],
-                     worldData.attrib.vertices[3 * i0 + 2]};
-        const v3f v1{worldData.attrib.vertices[3 * i1 + 0], worldData.attrib.vertices[3 * i1 + 1],
-                     worldData.attrib.vertices[3 * i1 + 2]};
-        const v3f v2{worldData.attrib.vertices[3 * i2 + 0], worldData.attrib.vertices[3 * i2 + 1],
-                     worldData.attrib.vertices[3 * i2 + 2]};
+    const GeometryStore& g = worldData.geometry;
+
+    for (size_t i = 0; i < g.getNbTriangles(shapeID); i++) {
+        const size_t tri = g.getTriangle(shapeID, i);
+        const v3f& v0 = g.getPosition(tri, 0);
+        const v3f& v1 = g.getPosition(tri, 1);
+        const v3f& v2 = g.getPosition(tri, 2);
 
         const v3f e1{v1 - v0};
         const v3f e2{v2 - v0};
@@ -314,12 +775,14 @@ v3f Scene::getFirstLightIntensity() const {
 
 float Scene::getShapeRadius(const size_t shapeID) const {
     assert(shapeID < worldData.shapes.size());
+    if (worldData.shapesAnalytic[shapeID].type == AnalyticShape::ESphere) return worldData.shapesAnalytic[shapeID].radius;
     v3f emitterCenter = worldData.shapesCenter[shapeID];
     return worldData.shapesAABOX[shapeID].max.x - emitterCenter.x;
 }
 
 v3f Scene::getShapeCenter(const size_t shapeID) const {
     assert(shapeID < worldData.shapes.size());
+    if (worldData.shapesAnalytic[shapeID].type == AnalyticShape::ESphere) return worldData.shapesAnalytic[shapeID].p;
     return worldData.shapesCenter[shapeID];
 }
 
@@ -329,29 +792,17 @@ size_t Scene::getFirstLight() const {
 }
 
 v3f Scene::getObjectVertexPosition(size_t objectIdx, size_t vertexIdx) const {
-    const tinyobj::attrib_t& sa = worldData.attrib;
-    const tinyobj::shape_t& s = worldData.shapes[objectIdx];
-
-    int idx = s.mesh.indices[vertexIdx].vertex_index;
-    float x = sa.vertices[3 * idx + 0];
-    float y = sa.vertices[3 * idx + 1];
-    float z = sa.vertices[3 * idx + 2];
-    return v3f(x,y,z);
+    const GeometryStore& g = worldData.geometry;
+    return g.getPosition(g.getTriangle(objectIdx, vertexIdx / 3), int(vertexIdx % 3));
 }
 
 v3f Scene::getObjectVertexNormal(size_t objectIdx, size_t vertexIdx) const {
-    const tinyobj::attrib_t& sa = worldData.attrib;
-    const tinyobj::shape_t& s = worldData.shapes[objectIdx];
-
-    int idx_n = s.mesh.indices[vertexIdx].normal_index;
-    float nx = sa.normals[3 * idx_n + 0];
-    float ny = sa.normals[3 * idx_n + 1];
-    float nz = sa.normals[3 * idx_n + 2];
-    return glm::normalize(v3f(nx,ny,nz));
+    const GeometryStore& g = worldData.geometry;
+    return glm::normalize(g.getNormal(g.getTriangle(objectIdx, vertexIdx / 3), int(vertexIdx % 3)));
 }
 
 size_t Scene::getObjectNbVertices(size_t objectIdx) const {
-    return worldData.shapes[objectIdx].mesh.indices.size();
+    return 3 * worldData.geometry.getNbTriangles(objectIdx);
 }
 
 int Scene::getPrimitiveID(size_t vertexIdx) const {
@@ -359,7 +810,8 @@ int Scene::getPrimitiveID(size_t vertexIdx) const {
 }
 
 int Scene::getMaterialID(size_t objectIdx, int primID) const {
-    return worldData.shapes[objectIdx].mesh.material_ids[primID];
+    const GeometryStore& g = worldData.geometry;
+    return g.materialIDs[g.getTriangle(objectIdx, size_t(primID))];
 }
 
 TR_NAMESPACE_END
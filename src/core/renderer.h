@@ -29,8 +29,11 @@ struct Renderer {
 
     explicit Renderer(const Config& config);
     bool init(bool isRealTime, bool nogui);
+    bool initIntegrator();
     void render();
     void cleanUp();
+    void reportMemory(const std::string& title) const;
+    void watch(const std::function<bool()>& reloadConfig);
 };
 
 TR_NAMESPACE_END
\ No newline at end of file
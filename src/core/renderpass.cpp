@@ -221,31 +221,28 @@ std::string RenderPass::readFile(const char* filePath) {
 }
 
 void RenderPass::buildVBO(size_t objectIdx) {
-    const tinyobj::attrib_t& sa = scene.worldData.attrib;
-    const tinyobj::shape_t& s = scene.worldData.shapes[objectIdx];
+    const GeometryStore& g = scene.worldData.geometry;
 
     GLObject& obj = objects[objectIdx];
 
-    obj.nVerts = s.mesh.indices.size();
+    std::vector<uint32_t> vertexIDs;
+    g.getShapeMesh(objectIdx, vertexIDs, obj.indices);
+    obj.nVerts = int(vertexIDs.size());
+    obj.nIndices = int(obj.indices.size());
     obj.vertices.resize(obj.nVerts * N_ATTR_PER_VERT);
     int k = 0;
-    for (size_t i = 0; i < s.mesh.indices.size(); i++) {
-        int idx = s.mesh.indices[i].vertex_index;
-        int idx_n = s.mesh.indices[i].normal_index;
-
+    for (uint32_t idx : vertexIDs) {
         // Position
-        obj.vertices[k + 0] = sa.vertices[3 * idx + 0];
-        obj.vertices[k + 1] = sa.vertices[3 * idx + 1];
-        obj.vertices[k + 2] = sa.vertices[3 * idx + 2];
+        const v3f& p = g.positions[idx];
+        obj.vertices[k + 0] = p.x;
+        obj.vertices[k + 1] = p.y;
+        obj.vertices[k + 2] = p.z;
 
         // Normal
-        float nx = sa.normals[3 * idx_n + 0];
-        float ny = sa.normals[3 * idx_n + 1];
-        float nz = sa.normals[3 * idx_n + 2];
-        float norm = std::sqrt(nx * nx + ny * ny + nz * nz);
-        obj.vertices[k + 3] = nx / norm;
-        obj.vertices[k + 4] = ny / norm;
-        obj.vertices[k + 5] = nz / norm;
+        const v3f n = glm::normalize(g.normals[idx]);
+        obj.vertices[k + 3] = n.x;
+        obj.vertices[k + 4] = n.y;
+        obj.vertices[k + 5] = n.z;
 
         k += N_ATTR_PER_VERT;
     }
@@ -260,6 +257,20 @@ void RenderPass::buildVBO(size_t objectIdx) {
                  sizeof(GLfloat) * obj.nVerts * N_ATTR_PER_VERT,
                  (GLvoid*) (&obj.vertices[0]),
                  GL_STATIC_DRAW);
+
+    buildEBO(objectIdx);
+}
+
+void RenderPass::buildEBO(size_t objectIdx) {
+    GLObject& obj = objects[objectIdx];
+
+    // Index buffer, recorded in the object's vertex array (which must be bound)
+    glGenBuffers(1, &obj.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(GLuint) * obj.nIndices,
+                 (GLvoid*) (&obj.indices[0]),
+                 GL_STATIC_DRAW);
 }
 
 void RenderPass::buildVAO(size_t objectIdx) {
@@ -287,10 +298,11 @@ void RenderPass::buildVAO(size_t objectIdx) {
 }
 
 void RenderPass::assignShader(GLObject& obj,
-                              const tinyobj::shape_t& s,
+                              size_t objectIdx,
                               const std::vector<std::unique_ptr<BSDF>>& bsdfs) {
     // Assign shader to object & push BSDF values to uniforms depending on shader type
-    int materialId = s.mesh.material_ids[0];
+    const GeometryStore& g = scene.worldData.geometry;
+    int materialId = g.materialIDs[g.getTriangle(objectIdx, 0)];
     const BSDF* bsdf = bsdfs[materialId].get();
 
     int bsdfType = scene.worldData.materials[materialId].illum;
@@ -317,8 +329,8 @@ void RenderPass::assignShader(GLObject& obj,
             obj.shaderIdx = PHONG_SHADER_IDX;
             const PhongBSDF* phong = static_cast<const PhongBSDF*>(bsdf);
             obj.exponent = phong->exponent.get()->getAverage();
-            obj.rho_d = phong->diffuseReflectance.get()->getAverage() * phong->scale;
-            obj.rho_s = phong->specularReflectance.get()->getAverage() * phong->scale;
+            obj.rho_d = phong->diffuseReflectance.get()->getAverage() * phong->getScale();
+            obj.rho_s = phong->specularReflectance.get()->getAverage() * phong->getScale();
             obj.exponentUniform = GLuint(glGetUniformLocation(obj.shaderID, "exponent"));
             obj.rho_d_Uniform = GLuint(glGetUniformLocation(obj.shaderID, "rho_d"));
             obj.rho_s_Uniform = GLuint(glGetUniformLocation(obj.shaderID, "rho_s"));
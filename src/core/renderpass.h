@@ -39,8 +39,12 @@ struct GLObject {
     GLuint shaderID{0};
     int shaderIdx{0};
 
+    GLuint ebo{0};
+
     int nVerts{0};
     std::vector<GLfloat> vertices;
+    int nIndices{0};
+    std::vector<GLuint> indices;    // Triangle corners, indexing the (welded) vertices
 
     // uniforms for diffuse shader
     GLuint albedoUniform{0};
@@ -107,6 +111,7 @@ struct RenderPass {
 
     virtual void buildVBO(size_t objectIdx);
     virtual void buildVAO(size_t objectIdx);
+    void buildEBO(size_t objectIdx);
 
     bool save(GLfloat* data);
     void updateCamera(SDL_Event& e);
@@ -117,7 +122,7 @@ struct RenderPass {
     GLuint compileShader(const char* shaderPath_, GLenum shaderType);
     GLuint compileShader_(const char* codePtr, GLenum shaderType);
     std::string readFile(const char* filePath);
-    void assignShader(GLObject& obj, const tinyobj::shape_t& s, const std::vector<std::unique_ptr<BSDF>>& bsdfs);
+    void assignShader(GLObject& obj, size_t objectIdx, const std::vector<std::unique_ptr<BSDF>>& bsdfs);
 
     // For Linear->sRGB post-process shader
     GLuint postprocess_quadShader;
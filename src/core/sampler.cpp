@@ -0,0 +1,96 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/sampler.h>
+#include <limits>
+
+TR_NAMESPACE_BEGIN
+
+const float* getBlueNoiseMask() {
+    static const std::vector<float> mask = buildBlueNoiseMask(BlueNoiseMaskSize, 446);
+    return mask.data();
+}
+
+std::vector<float> buildBlueNoiseMask(uint32_t size, uint64_t seed) {
+    const uint32_t n = size * size, mask = size - 1;
+    const int radius = 6;
+    const float sigma = 1.5f;
+
+    // Gaussian energy of the set pixels, updated incrementally as pixels are set or cleared
+    std::vector<float> kernel;
+    for (int dy = -radius; dy <= radius; dy++)
+        for (int dx = -radius; dx <= radius; dx++)
+            kernel.push_back(std::exp(-float(dx * dx + dy * dy) / (2.f * sigma * sigma)));
+    std::vector<float> energy(n, 0.f);
+    std::vector<uint8_t> pattern(n, 0);
+    const auto toggle = [&](uint32_t p, bool set) {
+        const uint32_t px = p & mask, py = p / size;
+        const float sign = set ? 1.f : -1.f;
+        const float* k = kernel.data();
+        for (int dy = -radius; dy <= radius; dy++) {
+            const uint32_t row = ((py + dy) & mask) * size;
+            for (int dx = -radius; dx <= radius; dx++)
+                energy[row + ((px + dx) & mask)] += sign * *k++;
+        }
+        pattern[p] = set;
+    };
+    const auto tightestCluster = [&]() {
+        uint32_t best = 0;
+        float e = -1.f;
+        for (uint32_t p = 0; p < n; p++)
+            if (pattern[p] && energy[p] > e) e = energy[best = p];
+        return best;
+    };
+    const auto largestVoid = [&]() {
+        uint32_t best = 0;
+        float e = std::numeric_limits<float>::max();
+        for (uint32_t p = 0; p < n; p++)
+            if (!pattern[p] && energy[p] < e) e = energy[best = p];
+        return best;
+    };
+
+    // Initial binary pattern: 10% random pixels, relaxed by moving the tightest cluster to the largest void
+    Sampler sampler(seed, 0);
+    uint32_t ones = 0;
+    while (ones < n / 10) {
+        const uint32_t p = sampler.nextUInt() & (n - 1);
+        if (!pattern[p]) {
+            toggle(p, true);
+            ones++;
+        }
+    }
+    while (true) {
+        const uint32_t cluster = tightestCluster();
+        toggle(cluster, false);
+        const uint32_t hole = largestVoid();
+        toggle(hole, true);
+        if (hole == cluster) break;
+    }
+
+    // Ranks: clusters removed from the initial pattern get the lowest ranks, voids filled the highest
+    std::vector<uint32_t> rank(n);
+    const std::vector<float> initialEnergy = energy;
+    const std::vector<uint8_t> initialPattern = pattern;
+    for (uint32_t r = ones; r-- > 0;) {
+        const uint32_t p = tightestCluster();
+        toggle(p, false);
+        rank[p] = r;
+    }
+    energy = initialEnergy;
+    pattern = initialPattern;
+    for (uint32_t r = ones; r < n; r++) {
+        const uint32_t p = largestVoid();
+        toggle(p, true);
+        rank[p] = r;
+    }
+
+    std::vector<float> values(n);
+    for (uint32_t p = 0; p < n; p++) values[p] = float(rank[p]) / float(n);
+    return values;
+}
+
+TR_NAMESPACE_END
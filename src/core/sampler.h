@@ -0,0 +1,358 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/math.h>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Sampler enumeration.
+ */
+enum ESampler {
+    EIndependentSampler = 0,    // Uniform random numbers (PCG32)
+    EStratifiedSampler,         // Jittered strata, shuffled per dimension (pair)
+    ESobolSampler,              // Owen-scrambled Sobol (first SobolDimensions dimensions), padded with PMJ02 beyond
+    EHaltonSampler,             // Owen-scrambled Halton (first HaltonDimensions dimensions)
+    EPMJ02Sampler               // Progressive multi-jittered (0,2) sequences, one per dimension pair
+};
+
+static constexpr uint32_t BlueNoiseMaskSize = 128;
+
+/**
+ * Tileable blue-noise dither mask of BlueNoiseMaskSize^2 values in [0, 1), each value appearing once.
+ * Built by void-and-cluster (Ulichney 1993) on first use, then shared by all samplers.
+ */
+const float* getBlueNoiseMask();
+
+/** Void-and-cluster ranking of a size x size toroidal grid (size a power of two), as values in [0, 1). */
+std::vector<float> buildBlueNoiseMask(uint32_t size, uint64_t seed);
+
+/**
+ * Sampler structure.
+ * Draws the random numbers of one pixel sample, one dimension at a time: next() uses one dimension,
+ * next2D() two. The independent backend is a PCG32 generator (O'Neill 2014, 16 bytes of state); the
+ * others are low-discrepancy over the samples of a pixel: call startPixelSample() before each sample,
+ * and setDimension() to give each sampling decision of a path a fixed dimension, so the values of a
+ * dimension stay well-stratified whatever the number of dimensions used before it.
+ * Dimensions beyond what a backend tabulates fall back to hashed random numbers.
+ * In blue-noise mode, every pixel draws the same sequence, shifted per pixel and dimension by
+ * a blue-noise mask (Georgiev and Fajardo 2016, "Blue-noise Dithered Sampling"): the error of
+ * neighbouring pixels is then anti-correlated, and low-spp noise is mostly high-frequency.
+ */
+struct Sampler {
+    static constexpr uint32_t SobolDimensions = 16;
+    static constexpr uint32_t HaltonDimensions = 64;
+    static constexpr float OneMinusEpsilon = 0.99999994f;   // Largest float below 1
+
+    ESampler type = EIndependentSampler;
+    uint64_t state;
+    uint64_t inc;
+    uint64_t seed = 0;
+    uint32_t pixelSeed = 0;
+    uint32_t sampleIndex = 0;
+    uint32_t sampleCount = 1;
+    uint32_t dimension = 0;
+    const float* blueNoise = nullptr;   // Blue-noise mask (BlueNoiseMaskSize^2 values), nullptr if disabled
+    uint32_t maskX = 0, maskY = 0;
+
+    explicit Sampler(int seed) { setSeed(seed); }
+    Sampler(uint64_t seed, uint64_t stream) { setSeed(seed, stream); }
+
+    /**
+     * Sampler of a given backend, for sampleCount samples per pixel, optionally blue-noise dithered.
+     */
+    Sampler(ESampler type, int sampleCount, uint64_t seed, bool blueNoise = false) : type(type), seed(seed) {
+        this->sampleCount = uint32_t(std::max(sampleCount, 1));
+        if (blueNoise) this->blueNoise = getBlueNoiseMask();
+        setSeed(seed, 0);
+    }
+
+    /**
+     * Starts sample index (in [0, sampleCount)) of pixel (x, y), at dimension 0.
+     */
+    void startPixelSample(int x, int y, uint32_t index) {
+        if (blueNoise) {
+            // Same sequence everywhere, the mask decorrelates the pixels
+            if (type == EIndependentSampler && index == 0) setSeed(seed, 0);
+            pixelSeed = hash(uint32_t(mix(seed)));
+            maskX = uint32_t(x);
+            maskY = uint32_t(y);
+        } else {
+            if (type == EIndependentSampler && index == 0) setSeed(seed, (uint64_t(uint32_t(y)) << 32) | uint32_t(x));
+            pixelSeed = hash(uint32_t(x) ^ hash(uint32_t(y) ^ uint32_t(mix(seed))));
+        }
+        sampleIndex = index;
+        dimension = 0;
+    }
+
+    /** Sets the dimension of the next value drawn. */
+    void setDimension(uint32_t d) { dimension = d; }
+
+    float next() {
+        float u = type == EIndependentSampler ? toFloat(nextUInt()) : sample1D(dimension);
+        if (blueNoise) u = dither(u, dimension);
+        dimension++;
+        return u;
+    }
+
+    p2f next2D() {
+        p2f u;
+        if (type == EIndependentSampler) {
+            u.x = toFloat(nextUInt());
+            u.y = toFloat(nextUInt());
+        } else {
+            u = sample2D(dimension);
+        }
+        if (blueNoise) u = {dither(u.x, dimension), dither(u.y, dimension + 1)};
+        dimension += 2;
+        return u;
+    }
+
+    /**
+     * Shifts a value of a dimension by the mask, read at an offset that differs per dimension.
+     * Sobol and pmj02 points are digital nets: they get a digital (xor) shift, which keeps the
+     * stratification of the samples of a pixel; the other backends get a toroidal shift.
+     */
+    float dither(float u, uint32_t dim) const {
+        const uint32_t offset = hash(dim ^ 0x5BD1E995u);
+        const uint32_t x = (maskX + offset) & (BlueNoiseMaskSize - 1);
+        const uint32_t y = (maskY + (offset >> 16)) & (BlueNoiseMaskSize - 1);
+        const float m = blueNoise[y * BlueNoiseMaskSize + x];
+        if (type == ESobolSampler || type == EPMJ02Sampler)
+            return toFloat(uint32_t(u * 4294967296.f) ^ uint32_t(m * 4294967296.f));
+        const float v = u + m;
+        return belowOne(v < 1.f ? v : v - 1.f);
+    }
+
+    uint32_t nextUInt() {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        const uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        const uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+    void setSeed(int seed) { setSeed(uint64_t(uint32_t(seed)), 0); }
+    void setSeed(uint64_t seed, uint64_t stream) {
+        // Scramble both: PCG sequences of consecutive streams with the same seed are correlated
+        state = 0;
+        inc = (mix(stream ^ seed) << 1u) | 1u;
+        nextUInt();
+        state += mix(seed + stream);
+        nextUInt();
+    }
+
+    /**
+     * Stateless sample in [0, 1) for a given (pixel, sample index, dimension), from a hash of the three.
+     * Gives the same value whatever the order in which samples are drawn.
+     */
+    static float sampleAt(uint32_t pixel, uint32_t index, uint32_t dimension, uint32_t seed = 0) {
+        return toFloat(hash(hash(hash(pixel ^ seed) ^ index) ^ dimension));
+    }
+
+    /** Integer hash with good avalanche (Wellons' lowbias32). */
+    static uint32_t hash(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    /** 64-bit finalizer of SplitMix64. */
+    static uint64_t mix(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    /** Float in [0, 1) from the 24 high bits of a 32-bit integer. */
+    static float toFloat(uint32_t x) { return float(x >> 8) * (1.f / 16777216.f); }
+
+    /** Clamps a value to [0, 1) against rounding. */
+    static float belowOne(float x) { return x < OneMinusEpsilon ? x : OneMinusEpsilon; }
+
+    static uint32_t reverseBits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00FF00FFu) << 8) | ((x & 0xFF00FF00u) >> 8);
+        x = ((x & 0x0F0F0F0Fu) << 4) | ((x & 0xF0F0F0F0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xCCCCCCCCu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xAAAAAAAAu) >> 1);
+        return x;
+    }
+
+    /**
+     * Owen scrambling of a 0.32 fixed-point value: each bit is flipped depending on the bits above it
+     * (Burley 2020, "Practical Hash-based Owen Scrambling"). Also used to shuffle sample indices, which
+     * keeps every power-of-two prefix of a sequence an aligned block.
+     */
+    static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+        x = reverseBits(x);
+        x += seed;
+        x ^= x * 0x6C50B47Cu;
+        x ^= x * 0xB82F1E52u;
+        x ^= x * 0xC7AFE638u;
+        x ^= x * 0x8D22F6E6u;
+        return reverseBits(x);
+    }
+
+    /**
+     * Sobol sample (0.32 fixed point) of an index in a dimension < SobolDimensions.
+     * Direction numbers from Joe and Kuo (2008).
+     */
+    static uint32_t sobol(uint32_t index, uint32_t dim) {
+        static const std::vector<uint32_t> matrices = buildSobolMatrices();
+        const uint32_t* v = &matrices[32 * dim];
+        uint32_t x = 0;
+        for (; index; index >>= 1, v++)
+            if (index & 1) x ^= *v;
+        return x;
+    }
+
+    static std::vector<uint32_t> buildSobolMatrices() {
+        // Degree, coefficients and initial direction numbers of the primitive polynomials of dimensions 1 and up
+        static const uint32_t s[SobolDimensions - 1] = {1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6};
+        static const uint32_t a[SobolDimensions - 1] = {0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14, 1, 13, 16};
+        static const uint32_t m[SobolDimensions - 1][6] = {
+            {1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3}, {1, 3, 5, 13}, {1, 1, 5, 5, 17}, {1, 1, 5, 5, 5},
+            {1, 1, 7, 11, 19}, {1, 1, 5, 1, 1}, {1, 1, 1, 3, 11}, {1, 3, 5, 5, 31}, {1, 3, 3, 9, 7, 49},
+            {1, 1, 1, 15, 21, 21}, {1, 3, 1, 13, 27, 49}};
+
+        std::vector<uint32_t> matrices(32 * SobolDimensions);
+        for (uint32_t i = 0; i < 32; i++) matrices[i] = 1u << (31 - i);
+        for (uint32_t d = 1; d < SobolDimensions; d++) {
+            uint32_t* v = &matrices[32 * d];
+            const uint32_t sd = s[d - 1];
+            for (uint32_t i = 0; i < sd; i++) v[i] = m[d - 1][i] << (31 - i);
+            for (uint32_t i = sd; i < 32; i++) {
+                v[i] = v[i - sd] ^ (v[i - sd] >> sd);
+                for (uint32_t k = 1; k < sd; k++)
+                    v[i] ^= ((a[d - 1] >> (sd - 1 - k)) & 1u) * v[i - k];
+            }
+        }
+        return matrices;
+    }
+
+    /**
+     * Owen-scrambled radical inverse of an index in a prime base: each digit is permuted depending on the
+     * digits above it, down to float precision. Unlike a random shift, this also scrambles the leading zero
+     * digits, which keeps large bases stratified at low sample counts.
+     */
+    static float owenRadicalInverse(uint32_t index, uint32_t base, uint32_t seed) {
+        const float invBase = 1.f / float(base);
+        float invBaseN = 1.f;
+        uint64_t digits = 0;
+        while (1.f - float(base - 1) * invBaseN < 1.f) {
+            const uint32_t digit = permute(index % base, base, hash(seed ^ uint32_t(mix(digits))));
+            digits = digits * base + digit;
+            invBaseN *= invBase;
+            index /= base;
+        }
+        return belowOne(float(digits) * invBaseN);
+    }
+
+    static uint32_t getPrime(uint32_t i) {
+        static const uint32_t primes[HaltonDimensions] = {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79,
+            83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181,
+            191, 193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293,
+            307, 311};
+        return primes[i];
+    }
+
+    /** Random permutation of [0, n) (Kensler 2013, "Correlated Multi-Jittered Sampling"). */
+    static uint32_t permute(uint32_t i, uint32_t n, uint32_t p) {
+        uint32_t w = n - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p;
+            i *= 0xE170893Du;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929EB3Fu;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935FA69u;
+            i ^= (i & w) >> 11;
+            i *= 0x74DCB303u;
+            i ^= (i & w) >> 2;
+            i *= 0x9E501CC3u;
+            i ^= (i & w) >> 2;
+            i *= 0xC860A3DFu;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= n);
+        return (i + p) % n;
+    }
+
+    /**
+     * Point of a pmj02 sequence: an Owen-scrambled (0,2)-sequence (Sobol dimensions 0 and 1), which has the
+     * progressive multi-jittered (0,2) stratification, taken at a shuffled index so that dimension pairs are
+     * decorrelated (Helmer et al. 2021, "Stochastic Generation of (t, s) Sample Sequences").
+     */
+    p2f pmj02(uint32_t dimSeed) const {
+        const uint32_t index = owenScramble(sampleIndex, dimSeed);
+        return {toFloat(owenScramble(reverseBits(index), hash(dimSeed))),
+                toFloat(owenScramble(sobol(index, 1), hash(dimSeed + 1)))};
+    }
+
+    uint32_t dimensionSeed(uint32_t dim) const { return hash(pixelSeed ^ (dim * 0x9E3779B9u)); }
+
+    float sample1D(uint32_t dim) const {
+        const uint32_t dimSeed = dimensionSeed(dim);
+        switch (type) {
+            case EStratifiedSampler: {
+                const uint32_t stratum = permute(sampleIndex, sampleCount, dimSeed);
+                return belowOne((float(stratum) + toFloat(hash(dimSeed ^ sampleIndex))) / float(sampleCount));
+            }
+            case ESobolSampler:
+                if (dim < SobolDimensions)
+                    return toFloat(owenScramble(sobol(owenScramble(sampleIndex, pixelSeed), dim), dimSeed));
+                return pmj02(dimSeed).x;
+            case EHaltonSampler:
+                if (dim < HaltonDimensions) return owenRadicalInverse(sampleIndex, getPrime(dim), dimSeed);
+                break;
+            case EPMJ02Sampler:
+                return pmj02(dimSeed).x;
+            default:
+                break;
+        }
+        return toFloat(hash(dimSeed ^ hash(sampleIndex)));
+    }
+
+    p2f sample2D(uint32_t dim) const {
+        const uint32_t dimSeed = dimensionSeed(dim);
+        switch (type) {
+            case EStratifiedSampler: {
+                const uint32_t nx = uint32_t(std::ceil(std::sqrt(float(sampleCount))));
+                const uint32_t ny = (sampleCount + nx - 1) / nx;
+                const uint32_t cell = permute(sampleIndex, nx * ny, dimSeed);
+                const float jx = toFloat(hash(dimSeed ^ sampleIndex)), jy = toFloat(hash(hash(dimSeed) ^ sampleIndex));
+                return {belowOne((float(cell % nx) + jx) / float(nx)), belowOne((float(cell / nx) + jy) / float(ny))};
+            }
+            case ESobolSampler:
+                if (dim + 1 < SobolDimensions) return {sample1D(dim), sample1D(dim + 1)};
+                return pmj02(dimSeed);
+            case EPMJ02Sampler:
+                return pmj02(dimSeed);
+            default:
+                return {sample1D(dim), sample1D(dim + 1)};
+        }
+    }
+};
+
+TR_NAMESPACE_END
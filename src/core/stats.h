@@ -0,0 +1,74 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <iomanip>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Ray type enumeration (for render statistics).
+ */
+enum ERayType {
+    ECameraRay = 0,
+    EShadowRay,
+    EBounceRay,
+    ERayTypes
+};
+
+#ifdef TR_ENABLE_STATS
+
+/**
+ * Render statistics structure.
+ * Counts rays by type, BVH nodes visited and primitives tested.
+ * Only compiled in when TR_ENABLE_STATS is defined, see the TR_STATS_* macros below.
+ */
+struct RenderStats {
+    uint64_t rays[ERayTypes]{};
+    uint64_t nodeVisits{0};
+    uint64_t primTests{0};
+
+    static RenderStats& get() {
+        static RenderStats stats;
+        return stats;
+    }
+
+    // Traversal cost so far, used to compute per-pixel deltas
+    uint64_t cost() const { return nodeVisits + primTests; }
+
+    void reset() { *this = RenderStats(); }
+
+    void print() const {
+        const char* names[ERayTypes] = {"camera", "shadow", "bounce"};
+        uint64_t nRays = 0;
+        for (int i = 0; i < ERayTypes; i++) nRays += rays[i];
+        const double perRay = nRays > 0 ? 1.0 / double(nRays) : 0.0;
+
+        std::cout << "Render statistics:" << std::endl;
+        for (int i = 0; i < ERayTypes; i++)
+            std::cout << "  " << std::left << std::setw(8) << names[i] << " rays: " << rays[i] << std::endl;
+        std::cout << "  total    rays: " << nRays << std::endl;
+        std::cout << "  node visits  : " << nodeVisits << " (" << double(nodeVisits) * perRay << " / ray)" << std::endl;
+        std::cout << "  prim tests   : " << primTests << " (" << double(primTests) * perRay << " / ray)" << std::endl;
+    }
+};
+
+#define TR_STATS_RAY(type) (++TinyRender::RenderStats::get().rays[type])
+#define TR_STATS_NODE_VISIT() (++TinyRender::RenderStats::get().nodeVisits)
+#define TR_STATS_PRIM_TEST() (++TinyRender::RenderStats::get().primTests)
+
+#else
+
+#define TR_STATS_RAY(type) ((void) 0)
+#define TR_STATS_NODE_VISIT() ((void) 0)
+#define TR_STATS_PRIM_TEST() ((void) 0)
+
+#endif
+
+TR_NAMESPACE_END
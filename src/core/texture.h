@@ -0,0 +1,473 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * MIP pyramid with tiled texel storage.
+ * Each level is stored in 4x4 tiles, texels in a tile follow a Morton (Z-order) curve,
+ * so texels that are close in the image are close in memory.
+ * Level l + 1 is a 2x2 filtered version of level l, down to a single texel.
+ */
+template<class T>
+struct MIPMap {
+    static const int TileLog = 2;
+    static const int TileSize = 1 << TileLog;
+
+    typedef std::function<T(const T&, const T&, const T&, const T&)> Filter;
+
+    struct Level {
+        int w, h, tilesX;
+        std::vector<T> texels;
+    };
+
+    std::vector<Level> levels;
+
+    /**
+     * Builds the pyramid from a w x h image, given as a texel accessor.
+     * Coarser levels combine 2x2 texels with the given filter (box filter by default).
+     */
+    void build(int w, int h, const std::function<T(int, int)>& texel, const Filter& filter = boxFilter) {
+        levels.clear();
+        addLevel(w, h, texel);
+
+        while (levels.back().w > 1 || levels.back().h > 1) {
+            const Level& fine = levels.back();
+            Level coarse = allocate(std::max(1, (fine.w + 1) / 2), std::max(1, (fine.h + 1) / 2));
+            for (int y = 0; y < coarse.h; y++) {
+                for (int x = 0; x < coarse.w; x++) {
+                    const int x0 = std::min(2 * x, fine.w - 1), x1 = std::min(2 * x + 1, fine.w - 1);
+                    const int y0 = std::min(2 * y, fine.h - 1), y1 = std::min(2 * y + 1, fine.h - 1);
+                    at(coarse, x, y) = filter(at(fine, x0, y0), at(fine, x1, y0), at(fine, x0, y1), at(fine, x1, y1));
+                }
+            }
+            levels.push_back(std::move(coarse));
+        }
+    }
+
+    /**
+     * Appends a w x h level, given as a texel accessor.
+     */
+    void addLevel(int w, int h, const std::function<T(int, int)>& texel) {
+        Level l = allocate(w, h);
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                at(l, x, y) = texel(x, y);
+        levels.push_back(std::move(l));
+    }
+
+    static T boxFilter(const T& a, const T& b, const T& c, const T& d) {
+        return (a + b + c + d) * 0.25f;
+    }
+
+    int getNbLevels() const { return int(levels.size()); }
+    int getWidth() const { return levels[0].w; }
+    int getHeight() const { return levels[0].h; }
+
+    const T& texel(int level, int x, int y) const {
+        const Level& l = levels[level];
+        return l.texels[offset(l, x, y)];
+    }
+
+    /**
+     * Nearest-texel lookup at texture coordinates st (in [0, 1]^2) on the given level.
+     */
+    const T& lookup(const v2f& st, int level) const {
+        const Level& l = levels[level];
+        const int x = std::min(std::max(int(st.x * l.w), 0), l.w - 1);
+        const int y = std::min(std::max(int(st.y * l.h), 0), l.h - 1);
+        return l.texels[offset(l, x, y)];
+    }
+
+    /**
+     * Level whose texels best match a footprint of the given width (in level 0 texels).
+     */
+    int getLevel(float texelFootprint) const {
+        if (!(texelFootprint > 1.f)) return 0;
+        return std::min(int(std::log2(texelFootprint)), getNbLevels() - 1);
+    }
+
+    size_t getMemoryUsage() const {
+        size_t bytes = 0;
+        for (const Level& l : levels) bytes += l.texels.size() * sizeof(T);
+        return bytes;
+    }
+
+private:
+    static Level allocate(int w, int h) {
+        Level l;
+        l.w = w;
+        l.h = h;
+        l.tilesX = (w + TileSize - 1) >> TileLog;
+        const int tilesY = (h + TileSize - 1) >> TileLog;
+        l.texels.assign(size_t(l.tilesX) * tilesY * TileSize * TileSize, T());
+        return l;
+    }
+
+    // Interleaves the low bits of v with zeros (abc -> a0b0c)
+    static inline int spreadBits(int v) {
+        return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2);
+    }
+
+    static inline size_t offset(const Level& l, int x, int y) {
+        const size_t tile = size_t(y >> TileLog) * l.tilesX + size_t(x >> TileLog);
+        return (tile << (2 * TileLog)) + size_t(spreadBits(x & (TileSize - 1)) | (spreadBits(y & (TileSize - 1)) << 1));
+    }
+
+    static inline T& at(Level& l, int x, int y) {
+        return l.texels[offset(l, x, y)];
+    }
+
+    static inline const T& at(const Level& l, int x, int y) {
+        return l.texels[offset(l, x, y)];
+    }
+};
+
+/**
+ * Gamma-encoded 8-bit RGB texel.
+ */
+struct RGB8 {
+    uint8_t r, g, b;
+};
+
+/**
+ * 256-entry table decoding gamma-encoded 8-bit values to linear floats (x / maxValue)^2.2.
+ * Encoding picks the nearest table entry, so no pow is needed per texel.
+ */
+struct GammaLUT {
+    float table[256];
+
+    explicit GammaLUT(int maxValue = 255) {
+        for (int i = 0; i < 256; i++)
+            table[i] = std::pow(float(std::min(i, maxValue)) / float(maxValue), 2.2f);
+    }
+
+    float decode(uint8_t v) const { return table[v]; }
+    v3f decode(const RGB8& c) const { return v3f(table[c.r], table[c.g], table[c.b]); }
+
+    uint8_t encode(float v) const {
+        const int i = int(std::lower_bound(table, table + 256, v) - table);
+        if (i == 0) return 0;
+        if (i == 256) return 255;
+        return uint8_t(v - table[i - 1] < table[i] - v ? i - 1 : i);
+    }
+    RGB8 encode(const v3f& c) const { return RGB8{encode(c.r), encode(c.g), encode(c.b)}; }
+
+    // Filters for MIP pyramids, averaging in linear space
+    uint8_t average(uint8_t a, uint8_t b, uint8_t c, uint8_t d) const {
+        return encode((table[a] + table[b] + table[c] + table[d]) * 0.25f);
+    }
+    RGB8 average(const RGB8& a, const RGB8& b, const RGB8& c, const RGB8& d) const {
+        return encode((decode(a) + decode(b) + decode(c) + decode(d)) * 0.25f);
+    }
+};
+
+/**
+ * BC1 (DXT1-style) block: 4x4 texels stored as two RGB565 endpoints and 2-bit indices.
+ * Indices select an endpoint or one of the two colors at 1/3 and 2/3 between them (8 bytes for 16 texels).
+ */
+struct BC1Block {
+    uint16_t c0, c1;
+    uint32_t indices;
+
+    static uint16_t pack565(const RGB8& c) {
+        return uint16_t(((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3));
+    }
+
+    static RGB8 unpack565(uint16_t c) {
+        const int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        return RGB8{uint8_t((r << 3) | (r >> 2)), uint8_t((g << 2) | (g >> 4)), uint8_t((b << 3) | (b >> 2))};
+    }
+
+    /**
+     * Compresses 16 texels (row-major in the block), using the bounding box diagonal as the color line.
+     */
+    static BC1Block compress(const RGB8 texels[16]) {
+        RGB8 lo{255, 255, 255}, hi{0, 0, 0};
+        for (int i = 0; i < 16; i++) {
+            lo = RGB8{std::min(lo.r, texels[i].r), std::min(lo.g, texels[i].g), std::min(lo.b, texels[i].b)};
+            hi = RGB8{std::max(hi.r, texels[i].r), std::max(hi.g, texels[i].g), std::max(hi.b, texels[i].b)};
+        }
+
+        BC1Block block{pack565(hi), pack565(lo), 0};
+        if (block.c0 == block.c1) return block;
+        if (block.c0 < block.c1) std::swap(block.c0, block.c1);  // c0 > c1 selects the 4-color mode
+
+        const RGB8 e0 = unpack565(block.c0), e1 = unpack565(block.c1);
+        const int d[3] = {e1.r - e0.r, e1.g - e0.g, e1.b - e0.b};
+        const int dd = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        static const uint32_t remap[4] = {0, 2, 3, 1};   // Position along the line to index (e0, 1/3, 2/3, e1)
+        for (int i = 0; i < 16; i++) {
+            const int dot = (texels[i].r - e0.r) * d[0] + (texels[i].g - e0.g) * d[1] + (texels[i].b - e0.b) * d[2];
+            const int step = std::min(std::max((3 * dot + dd / 2) / dd, 0), 3);
+            block.indices |= remap[step] << (2 * i);
+        }
+        return block;
+    }
+
+    RGB8 decode(int x, int y) const {
+        const RGB8 e0 = unpack565(c0), e1 = unpack565(c1);
+        switch ((indices >> (2 * (4 * y + x))) & 3) {
+            case 0: return e0;
+            case 1: return e1;
+            case 2:
+                if (c0 > c1)
+                    return RGB8{uint8_t((2 * e0.r + e1.r) / 3), uint8_t((2 * e0.g + e1.g) / 3), uint8_t((2 * e0.b + e1.b) / 3)};
+                return RGB8{uint8_t((e0.r + e1.r) / 2), uint8_t((e0.g + e1.g) / 2), uint8_t((e0.b + e1.b) / 2)};
+            default:
+                if (c0 > c1)
+                    return RGB8{uint8_t((e0.r + 2 * e1.r) / 3), uint8_t((e0.g + 2 * e1.g) / 3), uint8_t((e0.b + 2 * e1.b) / 3)};
+                return RGB8{0, 0, 0};
+        }
+    }
+};
+
+/**
+ * MIP pyramid of BC1 blocks, compressed level by level from an RGB8 pyramid.
+ */
+struct BC1MIPMap {
+    MIPMap<BC1Block> blocks;
+    std::vector<int> widths, heights;
+
+    void build(const MIPMap<RGB8>& source) {
+        blocks.levels.clear();
+        widths.clear();
+        heights.clear();
+        for (int level = 0; level < source.getNbLevels(); level++) {
+            const int w = source.levels[level].w, h = source.levels[level].h;
+            widths.push_back(w);
+            heights.push_back(h);
+            blocks.addLevel((w + 3) / 4, (h + 3) / 4, [&](int bx, int by) {
+                RGB8 texels[16];
+                for (int y = 0; y < 4; y++)
+                    for (int x = 0; x < 4; x++)
+                        texels[4 * y + x] = source.texel(level, std::min(4 * bx + x, w - 1), std::min(4 * by + y, h - 1));
+                return BC1Block::compress(texels);
+            });
+        }
+    }
+
+    int getNbLevels() const { return int(widths.size()); }
+    int getWidth() const { return widths[0]; }
+    int getHeight() const { return heights[0]; }
+
+    RGB8 texel(int level, int x, int y) const {
+        return blocks.texel(level, x >> 2, y >> 2).decode(x & 3, y & 3);
+    }
+
+    RGB8 lookup(const v2f& st, int level) const {
+        const int x = std::min(std::max(int(st.x * widths[level]), 0), widths[level] - 1);
+        const int y = std::min(std::max(int(st.y * heights[level]), 0), heights[level] - 1);
+        return texel(level, x, y);
+    }
+
+    int getLevel(float texelFootprint) const {
+        if (!(texelFootprint > 1.f)) return 0;
+        return std::min(int(std::log2(texelFootprint)), getNbLevels() - 1);
+    }
+
+    size_t getMemoryUsage() const { return blocks.getMemoryUsage(); }
+};
+
+/**
+ * Least-recently-used cache of texel tiles, bounded by a memory budget (in bytes, 0 for no limit).
+ * Tiles are identified by a 64-bit key and created on a miss by a loader, which may itself read
+ * other tiles from the cache (e.g. the finer MIP level a tile is filtered from).
+ */
+template<class T>
+class TileCache {
+public:
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    /**
+     * Texel i of the tile with the given key, calling load(std::vector<T>&) to fill the tile on a miss.
+     */
+    template<class Loader>
+    T read(uint64_t key, size_t i, const Loader& load) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            hits++;
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->texels[i];
+        }
+
+        misses++;
+        Tile tile{key, std::vector<T>()};
+        load(tile.texels);
+        bytes += tile.texels.size() * sizeof(T);
+        lru.push_front(std::move(tile));
+        index[key] = lru.begin();
+        const T value = lru.front().texels[i];
+        evict();
+        return value;
+    }
+
+    void clear() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        bytes = 0;
+        hits = misses = 0;
+    }
+
+    size_t getMemoryUsage() const { return bytes; }
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+
+private:
+    struct Tile {
+        uint64_t key;
+        std::vector<T> texels;
+    };
+
+    // Drops least recently used tiles until the cache fits in the budget (keeping at least one tile)
+    void evict() {
+        while (budget > 0 && bytes > budget && lru.size() > 1) {
+            bytes -= lru.back().texels.size() * sizeof(T);
+            index.erase(lru.back().key);
+            lru.pop_back();
+        }
+    }
+
+    std::list<Tile> lru;    // Most recently used first
+    std::unordered_map<uint64_t, typename std::list<Tile>::iterator> index;
+    std::recursive_mutex mutex;
+    size_t budget{0}, bytes{0};
+    uint64_t hits{0}, misses{0};
+};
+
+/**
+ * MIP pyramid whose texels are paged in and out of a shared TileCache, in 64x64 tiles.
+ * Level 0 tiles are read from the source image by a reader, coarser tiles are filtered from the finer level.
+ */
+template<class T>
+struct StreamedMIPMap {
+    static const int TileLog = 6;
+    static const int TileSize = 1 << TileLog;
+
+    /** Reads the w x h block at (x0, y0) of level 0 into out, rows being stride texels apart. */
+    typedef std::function<void(int x0, int y0, int w, int h, size_t stride, T* out)> Reader;
+
+    TileCache<T>* cache{nullptr};
+    uint64_t id{0};
+    std::vector<int> widths, heights;
+    Reader reader;
+    typename MIPMap<T>::Filter filter;
+
+    void init(TileCache<T>& tileCache, uint32_t textureID, int w, int h, const Reader& read,
+              const typename MIPMap<T>::Filter& filter2x2) {
+        cache = &tileCache;
+        id = textureID;
+        reader = read;
+        filter = filter2x2;
+        widths = {w};
+        heights = {h};
+        while (widths.back() > 1 || heights.back() > 1) {
+            widths.push_back(std::max(1, (widths.back() + 1) / 2));
+            heights.push_back(std::max(1, (heights.back() + 1) / 2));
+        }
+    }
+
+    int getNbLevels() const { return int(widths.size()); }
+    int getWidth() const { return widths[0]; }
+    int getHeight() const { return heights[0]; }
+
+    T texel(int level, int x, int y) const {
+        const uint64_t key = (id << 40) | (uint64_t(level) << 32) | (uint64_t(y >> TileLog) << 16) | uint64_t(x >> TileLog);
+        const size_t i = size_t(y & (TileSize - 1)) * TileSize + size_t(x & (TileSize - 1));
+        return cache->read(key, i, [&](std::vector<T>& texels) { loadTile(level, x >> TileLog, y >> TileLog, texels); });
+    }
+
+    T lookup(const v2f& st, int level) const {
+        const int x = std::min(std::max(int(st.x * widths[level]), 0), widths[level] - 1);
+        const int y = std::min(std::max(int(st.y * heights[level]), 0), heights[level] - 1);
+        return texel(level, x, y);
+    }
+
+    int getLevel(float texelFootprint) const {
+        if (!(texelFootprint > 1.f)) return 0;
+        return std::min(int(std::log2(texelFootprint)), getNbLevels() - 1);
+    }
+
+private:
+    void loadTile(int level, int tx, int ty, std::vector<T>& texels) const {
+        texels.assign(TileSize * TileSize, T());
+        const int x0 = tx * TileSize, y0 = ty * TileSize;
+        const int w = std::min(TileSize, widths[level] - x0), h = std::min(TileSize, heights[level] - y0);
+        if (level == 0) {
+            reader(x0, y0, w, h, TileSize, texels.data());
+            return;
+        }
+
+        // Same 2x2 filtering as MIPMap::build, reading the finer level through the cache
+        const int fw = widths[level - 1], fh = heights[level - 1];
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                const int fx0 = std::min(2 * (x0 + x), fw - 1), fx1 = std::min(2 * (x0 + x) + 1, fw - 1);
+                const int fy0 = std::min(2 * (y0 + y), fh - 1), fy1 = std::min(2 * (y0 + y) + 1, fh - 1);
+                texels[y * TileSize + x] = filter(texel(level - 1, fx0, fy0), texel(level - 1, fx1, fy0),
+                                                  texel(level - 1, fx0, fy1), texel(level - 1, fx1, fy1));
+            }
+        }
+    }
+};
+
+/**
+ * Summed-area table of a w x h image: the average over any axis-aligned box of texels in O(1).
+ * Sums are accumulated in double precision, so large tables stay accurate.
+ */
+struct SummedAreaTable {
+    int w{0}, h{0};
+    std::vector<glm::dvec3> sums;   // (w + 1) x (h + 1), first row and column are zero
+
+    void build(int width, int height, const std::function<v3f(int, int)>& texel) {
+        w = width;
+        h = height;
+        sums.assign(size_t(w + 1) * (h + 1), glm::dvec3(0.));
+        for (int y = 0; y < h; y++) {
+            glm::dvec3 row(0.);
+            for (int x = 0; x < w; x++) {
+                row += glm::dvec3(texel(x, y));
+                sums[size_t(y + 1) * (w + 1) + x + 1] = sums[size_t(y) * (w + 1) + x + 1] + row;
+            }
+        }
+    }
+
+    bool isBuilt() const { return !sums.empty(); }
+
+    /**
+     * Average over the texels covered by the box [st0, st1] (texture coordinates, clamped to [0, 1]^2).
+     * The box always covers at least one texel.
+     */
+    v3f boxAverage(const v2f& st0, const v2f& st1) const {
+        const int x0 = std::min(std::max(int(st0.x * w), 0), w - 1), y0 = std::min(std::max(int(st0.y * h), 0), h - 1);
+        const int x1 = std::min(std::max(int(std::ceil(st1.x * w)), x0 + 1), w);
+        const int y1 = std::min(std::max(int(std::ceil(st1.y * h)), y0 + 1), h);
+        const glm::dvec3 sum = at(x1, y1) - at(x0, y1) - at(x1, y0) + at(x0, y0);
+        return v3f(sum / double((x1 - x0) * (y1 - y0)));
+    }
+
+    size_t getMemoryUsage() const { return sums.size() * sizeof(glm::dvec3); }
+
+private:
+    const glm::dvec3& at(int x, int y) const { return sums[size_t(y) * (w + 1) + x]; }
+};
+
+TR_NAMESPACE_END
@@ -18,6 +18,30 @@ struct PathTracerIntegrator : Integrator {
         m_maxDepth = scene.config.integratorSettings.pt.maxDepth;
         m_rrDepth = scene.config.integratorSettings.pt.rrDepth;
         m_rrProb = scene.config.integratorSettings.pt.rrProb;
+        m_risCandidates = std::max(scene.config.integratorSettings.pt.risCandidates, 1);
+    }
+
+    /**
+     * Sample dimensions of a bounce, after the 2 of the pixel position. Each sampling decision gets its own
+     * dimension so that low-discrepancy samplers stay stratified along the path (see Sampler::setDimension).
+     */
+    enum EBounceDimension {
+        EBSDFDimension = 0,             // BSDF sample, for the direct lighting and the next bounce (2)
+        EEmitterDimension = 2,          // Emitter (or light tree) selection (1), then position on the emitter (up to 3)
+        ERouletteDimension = 6,         // Russian roulette (1)
+        EBounceDimensions = 7
+    };
+
+    static inline uint32_t getDimension(int depth, EBounceDimension d) {
+        return 2 + uint32_t(depth) * EBounceDimensions + d;
+    }
+
+    /**
+     * Sample dimensions of RIS candidate k > 0 of a bounce (candidate 0 uses EEmitterDimension): 4 for the
+     * emitter sample, then 1 to resample it. Kept apart from the bounce layout since M is not bounded.
+     */
+    static inline uint32_t getCandidateDimension(int depth, int k) {
+        return 0x80000000u | (uint32_t(depth) << 20) | (uint32_t(k) << 3);
     }
 
     static inline float balanceHeuristic(float nf, float fPdf, float ng, float gPdf) {
@@ -44,7 +68,9 @@ struct PathTracerIntegrator : Integrator {
 
                 //check if point light is visible from point
                 Ray sampleRay(hit.p, sampleDir);
+                setBounceCone(sampleRay, hit, pdf);
 
+                TR_STATS_RAY(EBounceRay);
                 if(!scene.bvh->intersect(sampleRay, hit))
                     return v3f(0.f);
             }
@@ -54,154 +80,166 @@ struct PathTracerIntegrator : Integrator {
         return Li;
     }
 
-    v3f directLighting(Sampler& sampler, SurfaceInteraction& hit) const {
-        v3f Lb(0.f);
-        //Use 1 since doing multiple spp, dont need multiple samples here
-        int m_emitterSamples = 1;
-        int m_bsdfSamples = 1;
-
-        for(int j = 0; j < m_bsdfSamples; j++) {
-            //SurfaceInteraction surfInt;
-            //SurfaceInteraction i;
-            float pdf;
-            glm::vec3 val(0.f);
-
-            v2f sample = sampler.next2D();
-
-            val = getBSDF(hit)->sample(hit, sample, &pdf);
-
-            glm::vec3 sampleDir = hit.frameNs.toWorld(hit.wi);
-
-            //check if point light is visible from point
-            Ray sampleRay(hit.p, sampleDir);
-
-            SurfaceInteraction i;
-            if(scene.bvh->intersect(sampleRay, i)){
-
-                //if visible to light find its color
-                if(getEmission(i) != v3f(0.f)) {
-
-
-                    float emPdf = 1.f/scene.emitters.size();
-                    const Emitter &em = getEmitterByID(getEmitterIDByShapeID(i.shapeID));
-                    v3f position = scene.getShapeCenter(em.shapeID);
-                    v3f intensity = em.getRadiance();
-                    float saPdf;
-                    v3f wiW;
-                    v3f emitterCenter = scene.getShapeCenter(em.shapeID);
-                    float emitterRadius = scene.getShapeRadius(em.shapeID);
-                    v3f n;
-                    v3f pos;
-
-                    sampleEmitterPosition(sampler, em, n, pos, saPdf);
-                    v3f emDir = glm::normalize(pos - hit.p);
-                    float cosFact = glm::dot(-emDir, n);
+    /**
+     * Emitter-sampled part of the direct lighting at hit: one emitter sample and its shadow ray, weighted
+     * against the BSDF sample of the same vertex (see renderExplicit).
+     */
+    v3f directLighting(Sampler& sampler, SurfaceInteraction& hit, const BSDF* bsdf, int depth) const {
+        if (m_risCandidates > 1)
+            return directLightingRIS(sampler, hit, bsdf, depth);
+
+        float pdf = 0.f;
+        size_t id;
+        v3f n;
+        v3f pos;
+        sampler.setDimension(getDimension(depth, EEmitterDimension));
+        if (!sampleLight(sampler, hit, id, n, pos, pdf))
+            return v3f(0.f);
 
-                    float bal = balanceHeuristic(m_bsdfSamples, pdf, m_emitterSamples, saPdf * emPdf / cosFact * glm::distance2(hit.p, pos));
+        v3f emDir = glm::normalize(pos - hit.p);
+        hit.wi = hit.frameNs.toLocal(emDir);
 
-                    Lb += val * getEmission(i) * bal;
-                }
+        Ray sampleRay(hit.p, emDir);
+        SurfaceInteraction i;
+        v3f Lsa(0.f);
+        float value = 0.f;  // Luminance of the estimate without MIS weight, for the light cache
+
+        TR_STATS_RAY(EShadowRay);
+        // Another emitter in the way occludes the sampled one
+        if (scene.bvh->intersect(sampleRay, i) && getEmission(i) != v3f(0.f) && getEmitterID(i) == id) {
+            float cosFact = glm::dot(-emDir, n);
+            if (cosFact > 0.f) {
+                float dist2 = glm::distance2(hit.p, pos);
+                v3f val = getEmission(i) / dist2 * bsdf->eval(hit) * cosFact / pdf;
+                float bal = balanceHeuristic(1, pdf / cosFact * dist2, 1, bsdf->pdf(hit));
+
+                Lsa = val * bal;
+                value = getLuminance(val);
             }
-
         }
-        if(m_bsdfSamples != 0)
-            Lb /= m_bsdfSamples;
-
-        v3f Lsa = v3f(0.f);
+        recordLight(hit, id, value);
 
-        //solid angle
-        for (int j = 0; j < m_emitterSamples; j++) {
+        return Lsa;
+    }
 
-            glm::vec3 directLight(0.f);
-            SurfaceInteraction i;
-            float pdf = 0.f;
-            float emPdf;
-            size_t id = selectEmitter(sampler.next(), emPdf);
-            const Emitter &em = getEmitterByID(id);
-            v3f intensity = em.getRadiance();
-            v3f n;
-            v3f pos;
-            sampleEmitterPosition(sampler, em, n, pos, pdf);
-
-            v3f emDir = glm::normalize(pos - hit.p);
-            hit.wi = hit.frameNs.toLocal(emDir);
-
-            Ray sampleRay(hit.p, emDir);
-
-            if (scene.bvh->intersect(sampleRay, i)) {
-                if (getEmission(i) != v3f(0.f)) {
-                    float cosFact = max(0.f, glm::dot(-emDir, n));
-                    float cosFact1 = glm::dot(-emDir, n);
-                    intensity = getEmission(i) / glm::distance2(hit.p, pos);
-                    v3f val = getBSDF(hit)->eval(hit);
-
-                    float bsdfPdf = getBSDF(hit)->pdf(hit);
-                    float bal = balanceHeuristic(m_emitterSamples, pdf * emPdf / cosFact1 * glm::distance2(hit.p, pos), m_bsdfSamples, bsdfPdf);
-
-                    Lsa = intensity * val * bal / pdf / emPdf * cosFact;
-                }
+    /**
+     * Emitter-sampled part of the direct lighting by resampled importance sampling (Talbot et al. 2005):
+     * M emitter samples are drawn as usual, weighted by their unshadowed contribution (BSDF, emission and
+     * geometry term) over their pdf, and one is kept with probability proportional to its weight. Only the
+     * kept one gets a shadow ray, and is weighted by W = sum(w) / (M * target). The MIS weight against BSDF
+     * sampling uses the pdf of the candidates, which keeps the pair unbiased whatever the resampling does.
+     * The light cache (if any) learns from the kept candidate, over its own pdf, as from an ordinary emitter sample.
+     */
+    v3f directLightingRIS(Sampler& sampler, SurfaceInteraction& hit, const BSDF* bsdf, int depth) const {
+        float wSum = 0.f;
+        float target = 0.f;     // Unshadowed contribution (luminance) of the kept candidate
+        float pdf = 0.f;        // Its emitter sampling pdf, in solid angle
+        size_t id = 0;
+        float cosL = 0.f;       // Its emitter cosine
+        v3f emDir, pos;
+
+        for (int k = 0; k < m_risCandidates; k++) {
+            size_t cId;
+            v3f cN, cPos;
+            float cPdf = 0.f;
+            sampler.setDimension(k == 0 ? getDimension(depth, EEmitterDimension) : getCandidateDimension(depth, k));
+            if (!sampleLight(sampler, hit, cId, cN, cPos, cPdf))
+                continue;
+
+            const v3f d = cPos - hit.p;
+            const float dist2 = glm::dot(d, d);
+            const v3f cDir = d / std::sqrt(dist2);
+            const float cCosL = glm::dot(-cDir, cN);
+            if (cCosL <= 0.f || cPdf <= 0.f)
+                continue;
+            hit.wi = hit.frameNs.toLocal(cDir);
+            const float cTarget = getLuminance(getEmitterByID(cId).getRadiance() * bsdf->eval(hit)) * cCosL / dist2;
+            if (!(cTarget > 0.f))
+                continue;
+
+            // Target and pdf both in area measure
+            const float w = cTarget / cPdf;
+            wSum += w;
+            if (k > 0)
+                sampler.setDimension(getCandidateDimension(depth, k) + 4);
+            if (k == 0 || sampler.next() * wSum < w) {
+                target = cTarget;
+                pdf = cPdf * dist2 / cCosL;
+                cosL = cCosL;
+                id = cId;
+                emDir = cDir;
+                pos = cPos;
             }
         }
-        if(m_emitterSamples != 0)
-            Lsa /= m_emitterSamples;
-
-        return Lsa + Lb;
-    }
+        if (target == 0.f)
+            return v3f(0.f);
 
-    v3f indirectLighting(Sampler& sampler, SurfaceInteraction& hit, int depth) const {
-        v3f Li(1.f);
+        hit.wi = hit.frameNs.toLocal(emDir);
+        Ray sampleRay(hit.p, emDir);
         SurfaceInteraction i;
-
-        if(getEmission(hit) != v3f(0.f) && depth == 0)
-            return getEmission(hit);
-
-        depth++;
-        if(m_maxDepth == -1) {
-            if(depth > m_rrDepth && sampler.next() > m_rrProb)
-                return v3f(0.f);
-        }
-        else if(depth >= m_maxDepth)
+        TR_STATS_RAY(EShadowRay);
+        if (!scene.bvh->intersect(sampleRay, i) || getEmission(i) == v3f(0.f) || getEmitterID(i) != id) {
+            recordLight(hit, id, 0.f);
             return v3f(0.f);
+        }
+        recordLight(hit, id, getLuminance(getEmission(i) * bsdf->eval(hit)) / pdf);
 
-        float pdf;
-        glm::vec3 indirectLight(0.f);
+        const float bal = balanceHeuristic(1, pdf, 1, bsdf->pdf(hit));
+        const float W = wSum / (float(m_risCandidates) * target);
+        return getEmission(i) * bsdf->eval(hit) * cosL / glm::distance2(hit.p, pos) * bal * W;
+    }
 
-        v3f emission = v3f(200.f);
-        int j = 0;
-        while(emission != v3f(0.f)) {
-            indirectLight = getBSDF(hit)->sample(hit, sampler.next2D(), &pdf);
+    /**
+     * Path tracing with next event estimation, one vertex per iteration. Each vertex gets an emitter sample and
+     * a single BSDF sample: the BSDF sample is MIS-weighted against emitter sampling if it reaches an emitter,
+     * and extends the path in any case. throughput is the weight of the path from the camera to hit.
+     */
+    v3f renderExplicit(const Ray& ray, Sampler& sampler, const SurfaceInteraction& primary) const {
+        SurfaceInteraction hit = primary;
+        v3f L = getEmission(hit);
+        v3f throughput(1.f);
 
-            glm::vec3 sampleDir = hit.frameNs.toWorld(hit.wi);
+        for (int depth = 0; m_maxDepth == -1 || depth < m_maxDepth; depth++) {
+            const BSDF* bsdf = getBSDF(hit);
+            L += throughput * directLighting(sampler, hit, bsdf, depth);
 
-            //check if point light is visible from point
+            float pdf = 0.f;
+            sampler.setDimension(getDimension(depth, EBSDFDimension));
+            const v3f val = bsdf->sample(hit, sampler.next2D(), &pdf);
+            if (pdf <= 0.f || val == v3f(0.f))
+                break;
+
+            const v3f sampleDir = hit.frameNs.toWorld(hit.wi);
             Ray sampleRay(hit.p, sampleDir);
+            setBounceCone(sampleRay, hit, pdf);
 
+            SurfaceInteraction i;
+            TR_STATS_RAY(EBounceRay);
             if (!scene.bvh->intersect(sampleRay, i))
-                return v3f(0.f);
-            if(j >= 5) //avoid getting stuck inside this loop too long, adds bias but would happen in MIS
-                return v3f(0.f);
-            emission = getEmission(i);
-            j++;
-        }
-
-        if(m_maxDepth == -1)
-            Li *= indirectLight / m_rrProb * (indirectLighting(sampler, i, depth) + directLighting(sampler, i));
-        else
-            Li *= indirectLight * (indirectLighting(sampler, i, depth) + directLighting(sampler, i));
-
-        return Li;
-    }
-
-    v3f renderExplicit(const Ray& ray, Sampler& sampler, SurfaceInteraction& hit) const {
-        v3f indirect(0.f);
-        v3f direct(0.f);
-
-        indirect = indirectLighting(sampler, hit, 0);
-
-        if(m_maxDepth != 0)
-            direct = directLighting(sampler, hit);
+                break;
+            throughput *= val;
+
+            const v3f emission = getEmission(i);
+            if (emission != v3f(0.f)) {
+                // Emitters only emit on the side of their normal, as in emitter sampling
+                const float cosFact = glm::dot(-sampleDir, i.frameNs.n);
+                if (cosFact > 0.f) {
+                    // Density of emitter sampling for the point hit, in solid angle
+                    const float emPdf = getLightPdf(hit, i) / cosFact * glm::distance2(hit.p, i.p);
+                    L += throughput * emission * balanceHeuristic(1, pdf, 1, emPdf);
+                }
+            }
 
-        return direct + indirect;
+            // Russian roulette on the vertices after the first m_rrDepth
+            if (m_maxDepth == -1 && depth + 1 > m_rrDepth) {
+                sampler.setDimension(getDimension(depth, ERouletteDimension));
+                if (sampler.next() > m_rrProb)
+                    break;
+                throughput /= m_rrProb;
+            }
+            hit = i;
+        }
+        return L;
     }
 
     v3f render(const Ray& ray, Sampler& sampler) const override {
@@ -221,6 +259,7 @@ struct PathTracerIntegrator : Integrator {
     int m_rrDepth;      // When to start Russian roulette
     float m_rrProb;     // Russian roulette probability
     bool m_isExplicit;  // Implicit or explicit
+    int m_risCandidates;    // Emitter candidates resampled per shading point (1: plain emitter sampling)
 };
 
 TR_NAMESPACE_END
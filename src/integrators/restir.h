@@ -0,0 +1,304 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Direct lighting of the primary hits by spatiotemporal reservoir reuse (ReSTIR, Bitterli et al. 2020).
+ * The image is rendered in passes of one sample per pixel. In each pass, every pixel draws candidates with
+ * sampleLight and keeps one in a reservoir (resampled importance sampling, target: unshadowed contribution),
+ * combines it with its reservoir of the previous pass (temporal reuse) and with those of a few neighbouring
+ * pixels (spatial reuse), then traces a single shadow ray for the light sample it ends up with.
+ * In unbiased mode, the normalization only counts the pixels that could have produced the selected sample,
+ * which takes one shadow ray per reused reservoir.
+ */
+struct ReSTIRIntegrator : Integrator {
+    explicit ReSTIRIntegrator(const Scene& scene) : Integrator(scene),
+        m_reuseSampler(scene.config.sampler, scene.config.spp, 0x2545F491u, scene.config.blueNoise) {
+        m_candidates = std::max(scene.config.integratorSettings.rs.candidates, 1);
+        m_spatialSamples = std::max(scene.config.integratorSettings.rs.spatialSamples, 0);
+        m_spatialRadius = scene.config.integratorSettings.rs.spatialRadius;
+        m_temporal = scene.config.integratorSettings.rs.temporal;
+        m_maxHistory = scene.config.integratorSettings.rs.maxHistory;
+        m_unbiased = scene.config.integratorSettings.rs.unbiased;
+    }
+
+    /** Point sampled on an emitter. */
+    struct LightSample {
+        v3f pos, n;
+        size_t emitterID;
+    };
+
+    /** Weighted reservoir holding one light sample. */
+    struct Reservoir {
+        LightSample y;
+        float wSum = 0.f;   // Sum of the resampling weights
+        float M = 0.f;      // Number of candidates it stands for
+        float W = 0.f;      // Contribution weight of y (estimate of 1 / pdf)
+
+        /** Streams a candidate of weight w in, keeps it with probability w / wSum (u uniform in [0, 1)). */
+        bool update(const LightSample& s, float w, float m, float u) {
+            wSum += w;
+            M += m;
+            if (w > 0.f && u * wSum < w) {
+                y = s;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    /** Primary hit of a pixel sample, with its reservoir. */
+    struct PixelState {
+        SurfaceInteraction hit;
+        bool valid = false;
+        Reservoir r;
+    };
+
+    /**
+     * Dimensions of the pass sampler (after the 2 of the pixel position): 4 per candidate, then 1 to
+     * resample it; of the reuse sampler: 1 for the temporal reservoir, then 3 per spatial neighbour.
+     */
+    static inline uint32_t getCandidateDimension(int k) { return 2 + 5 * uint32_t(k); }
+    static inline uint32_t getNeighbourDimension(int k) { return 1 + 3 * uint32_t(k); }
+
+    bool init() override {
+        Integrator::init();
+        const size_t n = size_t(scene.config.width) * scene.config.height;
+        m_current.assign(n, PixelState());
+        m_reused.assign(n, PixelState());
+        m_previous.assign(n, PixelState());
+        return true;
+    }
+
+    size_t getMemoryUsage() const override {
+        return Integrator::getMemoryUsage()
+               + (m_current.capacity() + m_reused.capacity() + m_previous.capacity()) * sizeof(PixelState);
+    }
+
+    /**
+     * Unshadowed contribution (luminance of BSDF, emission and geometry term) of light sample s at hit: the target
+     * of the resampling, in area measure.
+     */
+    float getTarget(SurfaceInteraction hit, const LightSample& s) const {
+        const v3f d = s.pos - hit.p;
+        const float dist2 = glm::dot(d, d);
+        const v3f dir = d / std::sqrt(dist2);
+        const float cosL = glm::dot(-dir, s.n);
+        if (cosL <= 0.f) return 0.f;
+        hit.wi = hit.frameNs.toLocal(dir);
+        return getLuminance(getEmitterByID(s.emitterID).getRadiance() * getBSDF(hit)->eval(hit)) * cosL / dist2;
+    }
+
+    /**
+     * Traces a shadow ray from hit towards light sample s. Returns true and the shadow ray hit if s is visible.
+     */
+    bool isVisible(const SurfaceInteraction& hit, const LightSample& s, SurfaceInteraction& i) const {
+        Ray sampleRay(hit.p, glm::normalize(s.pos - hit.p));
+        TR_STATS_RAY(EShadowRay);
+        return scene.bvh->intersect(sampleRay, i) && getEmission(i) != v3f(0.f) && getEmitterID(i) == s.emitterID;
+    }
+
+    /** Whether the surfaces seen by two pixels are close enough for their reservoirs to be reused. */
+    static bool isSimilar(const PixelState& a, const PixelState& b) {
+        return b.valid && glm::dot(a.hit.frameNs.n, b.hit.frameNs.n) > 0.906f        // 25 degrees
+               && std::abs(a.hit.t - b.hit.t) < 0.1f * a.hit.t;
+    }
+
+    /**
+     * Initial reservoir of a pixel sample: resamples one of m_candidates emitter samples, then discards it if
+     * occluded so that occluded samples are not spread to the neighbours.
+     */
+    void sampleCandidates(Sampler& sampler, PixelState& px) const {
+        Reservoir& r = px.r;
+        r = Reservoir();
+        float target = 0.f;
+        for (int k = 0; k < m_candidates; k++) {
+            LightSample s;
+            float pdf = 0.f;
+            sampler.setDimension(getCandidateDimension(k));
+            if (!sampleLight(sampler, px.hit, s.emitterID, s.n, s.pos, pdf) || pdf <= 0.f) {
+                r.M += 1.f;
+                continue;
+            }
+            const float t = getTarget(px.hit, s);
+            if (r.update(s, t / pdf, 1.f, sampler.next()))
+                target = t;
+        }
+        SurfaceInteraction i;
+        r.W = target > 0.f && isVisible(px.hit, r.y, i) ? r.wSum / (r.M * target) : 0.f;
+    }
+
+    /**
+     * Combines the reservoir of pixel q (first of inputs) with its temporal or spatial neighbours, and
+     * normalizes the result either by all the candidates seen (biased) or by those of the pixels for which the
+     * selected sample has a non-zero, unoccluded contribution (unbiased).
+     */
+    Reservoir combine(Sampler& sampler, const PixelState& q, const std::vector<const PixelState*>& inputs,
+                      bool temporal) const {
+        Reservoir r;
+        float target = 0.f;
+        int selected = -1;
+        for (size_t k = 0; k < inputs.size(); k++) {
+            const Reservoir& in = inputs[k]->r;
+            const float t = in.W > 0.f ? getTarget(q.hit, in.y) : 0.f;
+            sampler.setDimension(temporal || k == 0 ? 0u : getNeighbourDimension(int(k) - 1) + 2);
+            if (r.update(in.y, t * in.W * in.M, in.M, sampler.next())) {
+                target = t;
+                selected = int(k);
+            }
+        }
+        if (target == 0.f) {
+            r.W = 0.f;
+            return r;
+        }
+
+        // Reservoirs only hold samples visible from their pixel: the normalization below relies on it
+        SurfaceInteraction i;
+        if (m_unbiased && selected != 0 && !isVisible(q.hit, r.y, i)) {
+            r.W = 0.f;
+            return r;
+        }
+
+        float Z = r.M;
+        if (m_unbiased) {
+            Z = 0.f;
+            for (size_t k = 0; k < inputs.size(); k++) {
+                const PixelState& p = *inputs[k];
+                if (int(k) == selected || &p == &q) {
+                    Z += p.r.M;
+                    continue;
+                }
+                if (getTarget(p.hit, r.y) > 0.f && isVisible(p.hit, r.y, i))
+                    Z += p.r.M;
+            }
+        }
+        r.W = r.wSum / (Z * target);
+        return r;
+    }
+
+    bool renderPasses(const CameraRayGenerator& cameraRay, Sampler& sampler) override {
+        const int width = scene.config.width, height = scene.config.height;
+        const int spp = scene.config.spp;
+        std::vector<const PixelState*> inputs;
+#ifdef TR_ENABLE_STATS
+        cost->clear();  // Traversal cost of each pixel over all stages of all passes, like Renderer::render
+#endif
+
+        for (int pass = 0; pass < spp; pass++) {
+            // Primary hits and initial candidates
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const size_t id = size_t(y) * width + x;
+                    PixelState& px = m_current[id];
+#ifdef TR_ENABLE_STATS
+                    const uint64_t pixelCost = RenderStats::get().cost();
+#endif
+                    Ray ray = cameraRay(x, y, uint32_t(pass), sampler);
+                    TR_STATS_RAY(ECameraRay);
+                    px.valid = scene.bvh->intersect(ray, px.hit);
+                    px.r = Reservoir();
+                    if (px.valid)
+                        sampleCandidates(sampler, px);
+#ifdef TR_ENABLE_STATS
+                    cost->data[id] += v3f(float(RenderStats::get().cost() - pixelCost));
+#endif
+                }
+            }
+
+            // Temporal reuse, from the final reservoirs of the previous pass
+            if (m_temporal && pass > 0) {
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        const size_t id = size_t(y) * width + x;
+                        PixelState& px = m_current[id];
+                        PixelState prev = m_previous[id];
+                        if (!px.valid || !isSimilar(px, prev)) continue;
+#ifdef TR_ENABLE_STATS
+                        const uint64_t pixelCost = RenderStats::get().cost();
+#endif
+                        // Bound the history so that the reservoir keeps adapting
+                        prev.r.M = std::min(prev.r.M, float(m_maxHistory) * px.r.M);
+                        m_reuseSampler.startPixelSample(x, y, uint32_t(pass));
+                        inputs.assign({&px, &prev});
+                        px.r = combine(m_reuseSampler, px, inputs, true);
+#ifdef TR_ENABLE_STATS
+                        cost->data[id] += v3f(float(RenderStats::get().cost() - pixelCost));
+#endif
+                    }
+                }
+            }
+
+            // Spatial reuse, then shading
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const size_t id = size_t(y) * width + x;
+                    const PixelState& px = m_current[id];
+                    PixelState& out = m_reused[id];
+                    out = px;
+                    if (!px.valid) continue;
+#ifdef TR_ENABLE_STATS
+                    const uint64_t pixelCost = RenderStats::get().cost();
+#endif
+
+                    m_reuseSampler.startPixelSample(x, y, uint32_t(pass));
+                    inputs.assign(1, &px);
+                    for (int k = 0; k < m_spatialSamples; k++) {
+                        m_reuseSampler.setDimension(getNeighbourDimension(k));
+                        const v2f offset = m_spatialRadius * Warp::squareToUniformDiskConcentric(m_reuseSampler.next2D());
+                        const int nx = x + int(std::round(offset.x)), ny = y + int(std::round(offset.y));
+                        if (nx < 0 || ny < 0 || nx >= width || ny >= height || (nx == x && ny == y)) continue;
+                        const PixelState& n = m_current[size_t(ny) * width + nx];
+                        if (isSimilar(px, n)) inputs.push_back(&n);
+                    }
+                    if (inputs.size() > 1)
+                        out.r = combine(m_reuseSampler, px, inputs, false);
+
+                    v3f L = getEmission(px.hit);
+                    SurfaceInteraction i;
+                    if (out.r.W > 0.f && isVisible(px.hit, out.r.y, i)) {
+                        SurfaceInteraction hit = px.hit;
+                        const v3f d = out.r.y.pos - hit.p;
+                        const float dist2 = glm::dot(d, d);
+                        hit.wi = hit.frameNs.toLocal(d / std::sqrt(dist2));
+                        const float cosL = std::max(glm::dot(-d, out.r.y.n), 0.f) / std::sqrt(dist2);
+                        L += getEmission(i) * getBSDF(hit)->eval(hit) * cosL / dist2 * out.r.W;
+                    } else {
+                        out.r.W = 0.f;  // Keep occluded samples out of the next pass
+                    }
+                    rgb->data[id] += L;
+#ifdef TR_ENABLE_STATS
+                    cost->data[id] += v3f(float(RenderStats::get().cost() - pixelCost));
+#endif
+                }
+            }
+            std::swap(m_reused, m_previous);
+        }
+        rgb->scale(1.f / float(spp));
+#ifdef TR_ENABLE_STATS
+        cost->scale(1.f / float(spp));
+#endif
+        return true;
+    }
+
+    v3f render(const Ray& ray, Sampler& sampler) const override {
+        return v3f(0.f);
+    }
+
+    int m_candidates;       // Emitter samples drawn per pixel and pass
+    int m_spatialSamples;   // Neighbouring reservoirs reused per pixel and pass
+    float m_spatialRadius;  // Radius (in pixels) in which they are picked
+    bool m_temporal;        // Reuse the reservoir of the previous pass
+    int m_maxHistory;       // Bound of the temporal history, in multiples of m_candidates
+    bool m_unbiased;        // Normalize with visibility checks (unbiased) or by the candidate count (biased)
+    Sampler m_reuseSampler; // Random numbers of the reuse steps, independent of those of the pass
+    std::vector<PixelState> m_current, m_reused, m_previous;
+};
+
+TR_NAMESPACE_END
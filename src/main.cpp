@@ -10,8 +10,6 @@
 #include <core/renderer.h>
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
 
 
 
@@ -24,6 +22,15 @@ bool loadTOML(TinyRender::Config& config, const std::string& inputFile) {
     config.tomlFile = inputFile;
     const auto input = data->get_table("input");
     config.objFile = *input->get_as<std::string>("objfile");
+    config.meshCache = input->get_as<bool>("meshcache").value_or(true);
+    config.triangleRecords = input->get_as<bool>("trianglerecords").value_or(false);
+    config.weldEpsilon = float(input->get_as<double>("weldepsilon").value_or(0.0));
+    config.textureCompression = input->get_as<int>("compresstextures").value_or(0);
+    config.textureBudget = input->get_as<int>("texturebudget").value_or(0);
+    config.textureLoading = input->get_as<std::string>("textureloading").value_or("async");
+    config.textureSAT = input->get_as<bool>("texturesat").value_or(false);
+    config.lightTree = input->get_as<bool>("lighttree").value_or(false);
+    config.analyticEmitters = input->get_as<bool>("analyticemitters").value_or(false);
 
     // Camera settings
     const auto camera = data->get_table("camera");
@@ -95,12 +102,49 @@ bool loadTOML(TinyRender::Config& config, const std::string& inputFile) {
             config.integratorSettings.pt.maxDepth = renderer->get_as<int>("maxDepth").value_or(-1);
             config.integratorSettings.pt.rrDepth = renderer->get_as<int>("rrDepth").value_or(5);
             config.integratorSettings.pt.rrProb = renderer->get_as<double>("rrProb").value_or(0.95f);
+            config.integratorSettings.pt.risCandidates = renderer->get_as<int>("risCandidates").value_or(1);
+        }
+        else if (type == "restir") {
+            config.integrator = TinyRender::EReSTIRIntegrator;
+            config.integratorSettings.rs.candidates = renderer->get_as<int>("candidates").value_or(32);
+            config.integratorSettings.rs.spatialSamples = renderer->get_as<int>("spatialSamples").value_or(5);
+            config.integratorSettings.rs.spatialRadius = renderer->get_as<double>("spatialRadius").value_or(5.f);
+            config.integratorSettings.rs.temporal = renderer->get_as<bool>("temporal").value_or(true);
+            config.integratorSettings.rs.maxHistory = renderer->get_as<int>("maxHistory").value_or(20);
+            config.integratorSettings.rs.unbiased = renderer->get_as<bool>("unbiased").value_or(true);
         }
         else {
             throw std::runtime_error("Invalid integrator type");
         }
 
         config.spp = renderer->get_as<int>("spp").value_or(1);
+
+        auto sampler = renderer->get_as<std::string>("sampler").value_or("independent");
+        if (sampler == "independent")
+            config.sampler = TinyRender::EIndependentSampler;
+        else if (sampler == "stratified")
+            config.sampler = TinyRender::EStratifiedSampler;
+        else if (sampler == "sobol")
+            config.sampler = TinyRender::ESobolSampler;
+        else if (sampler == "halton")
+            config.sampler = TinyRender::EHaltonSampler;
+        else if (sampler == "pmj02")
+            config.sampler = TinyRender::EPMJ02Sampler;
+        else
+            throw std::runtime_error("Invalid sampler type");
+        config.blueNoise = renderer->get_as<bool>("blueNoise").value_or(false);
+
+        auto emitterSampling = renderer->get_as<std::string>("emitterSampling").value_or("area");
+        if (emitterSampling == "area")
+            config.emitterSampling = TinyRender::EAreaEmitterSampling;
+        else if (emitterSampling == "solidangle")
+            config.emitterSampling = TinyRender::ESolidAngleEmitterSampling;
+        else if (emitterSampling == "projected")
+            config.emitterSampling = TinyRender::EProjectedSolidAngleEmitterSampling;
+        else
+            throw std::runtime_error("Invalid emitter sampling strategy");
+        config.lightCache = renderer->get_as<bool>("lightCache").value_or(false);
+        config.lightCacheResolution = renderer->get_as<int>("lightCacheResolution").value_or(16);
     }
 
     return realTime;
@@ -109,7 +153,7 @@ bool loadTOML(TinyRender::Config& config, const std::string& inputFile) {
 /**
  * Launch rendering job.
  */
-void run(std::string& inputTOMLFile, bool nogui) {
+void run(std::string& inputTOMLFile, bool nogui, bool watch) {
     TinyRender::Config config;
     bool isRealTime;
 
@@ -124,26 +168,45 @@ void run(std::string& inputTOMLFile, bool nogui) {
     renderer.init(isRealTime, nogui);
     renderer.render();
     renderer.cleanUp();
+
+    if (watch && !isRealTime) {
+        renderer.watch([&]() {
+            try {
+                // Parse into a copy: a file that fails halfway must not leave the scene with a mixed config
+                TinyRender::Config reloaded;
+                loadTOML(reloaded, inputTOMLFile);
+                config = reloaded;
+                return true;
+            } catch (std::exception const& e) {
+                std::cerr << "Error while parsing scene file: " << e.what() << std::endl;
+                return false;
+            }
+        });
+    }
 }
 
 /**
  * Main TinyRender program.
  */
 int main(int argc, char* argv[]) {
-    if (argc != 2 && argc !=3) {
-        cerr << "Syntax: " << argv[0] << " <scene.toml>" << endl;
+    if (argc < 2 || argc > 4) {
+        cerr << "Syntax: " << argv[0] << " <scene.toml> [nogui] [watch]" << endl;
         exit(EXIT_FAILURE);
     }
 
     bool nogui = false;
-    if(argc == 3) {
-        if(std::string(argv[2]) == "nogui") {
+    bool watch = false;
+    for (int i = 2; i < argc; i++) {
+        if(std::string(argv[i]) == "nogui") {
             nogui = true;
         }
+        if(std::string(argv[i]) == "watch") {
+            watch = true;
+        }
     }
 
     auto inputTOMLFile = std::string(argv[1]);
-    run(inputTOMLFile, nogui);
+    run(inputTOMLFile, nogui, watch);
 
 #ifdef _WIN32
     if(!nogui) system("pause");
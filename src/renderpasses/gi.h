@@ -33,50 +33,52 @@ struct GIPass : RenderPass {
         m_ptIntegrator->m_maxDepth = scene.config.integratorSettings.gi.maxDepth;
         m_ptIntegrator->m_rrProb = scene.config.integratorSettings.gi.rrProb;
         m_ptIntegrator->m_rrDepth = scene.config.integratorSettings.gi.rrDepth;
+        m_ptIntegrator->m_risCandidates = 1;
         m_samplePerVertex = scene.config.integratorSettings.gi.samplesByVertex;
     }
 
+    /**
+     * Bakes the lighting once per welded vertex of the object, triangles share it through the index buffer.
+     */
     virtual void buildVBO(size_t objectIdx) override {
         GLObject& obj = objects[objectIdx];
 
-        // TODO: Implement this
-        const tinyobj::attrib_t& sa = scene.worldData.attrib;
-        const tinyobj::shape_t& s = scene.worldData.shapes[objectIdx];
+        const GeometryStore& g = scene.worldData.geometry;
 
-        obj.nVerts = s.mesh.indices.size();
+        std::vector<uint32_t> vertexIDs;
+        g.getShapeMesh(objectIdx, vertexIDs, obj.indices);
+        obj.nVerts = int(vertexIDs.size());
+        obj.nIndices = int(obj.indices.size());
         obj.vertices.resize(obj.nVerts * N_ATTR_PER_VERT);
 
+        // A primitive using each vertex
+        std::vector<int> vertexPrim(obj.nVerts, -1);
+        for (int i = obj.nIndices - 1; i >= 0; i--)
+            vertexPrim[obj.indices[i]] = scene.getPrimitiveID(size_t(i));
+
         int k = 0;
-        for (size_t i = 0; i < s.mesh.indices.size(); i++) {
-            int idx = s.mesh.indices[i].vertex_index;
-            int idx_n = s.mesh.indices[i].normal_index;
+        for (int i = 0; i < obj.nVerts; i++) {
+            const uint32_t idx = vertexIDs[i];
 
             // Position
-            obj.vertices[k + 0] = sa.vertices[3 * idx + 0];
-            obj.vertices[k + 1] = sa.vertices[3 * idx + 1];
-            obj.vertices[k + 2] = sa.vertices[3 * idx + 2];
-            v3f pos = v3f(sa.vertices[3 * idx + 0], sa.vertices[3 * idx + 1], sa.vertices[3 * idx + 2]);
+            const v3f pos = g.positions[idx];
+            obj.vertices[k + 0] = pos.x;
+            obj.vertices[k + 1] = pos.y;
+            obj.vertices[k + 2] = pos.z;
 
             // Normal
-            float nx = sa.normals[3 * idx_n + 0];
-            float ny = sa.normals[3 * idx_n + 1];
-            float nz = sa.normals[3 * idx_n + 2];
-            float norm = std::sqrt(nx * nx + ny * ny + nz * nz);
-            v3f n = v3f(nx / norm, ny / norm, nz / norm);
-//            obj.vertices[k + 3] = nx / norm;
-//            obj.vertices[k + 4] = ny / norm;
-//            obj.vertices[k + 5] = nz / norm;
+            const v3f n = glm::normalize(g.normals[idx]);
 
             //Colour
             SurfaceInteraction surfInt;
-            surfInt.primID = scene.getPrimitiveID(i);  //TODO: Check if I is correct
+            surfInt.primID = vertexPrim[i];
             surfInt.matID = scene.getMaterialID(objectIdx, surfInt.primID);
             surfInt.shapeID = objectIdx;
             surfInt.p = pos + n * Epsilon;
             surfInt.frameNs = Frame(n);
             surfInt.frameNg = Frame(n);
 
-            Sampler sampler(260744278);
+            Sampler sampler(260744278, idx);   // One stream per vertex
 
             v3f sampleDir = Warp::squareToUniformSphere(sampler.next2D());
 
@@ -91,12 +93,6 @@ struct GIPass : RenderPass {
             }
             color /= m_samplePerVertex;
 
-//            for(int j = 0; j < 4; j++){
-//                color += m_ptIntegrator->renderExplicit(ray, sampler, surfInt);
-//            }
-//            color /= 4;
-
-
             obj.vertices[k + 3] = color.r;
             obj.vertices[k + 4] = color.g;
             obj.vertices[k + 5] = color.b;
@@ -114,6 +110,8 @@ struct GIPass : RenderPass {
                      sizeof(GLfloat) * obj.nVerts * N_ATTR_PER_VERT,
                      (GLvoid*) (&obj.vertices[0]),
                      GL_STATIC_DRAW);
+
+        buildEBO(objectIdx);
     }
 
     bool init(const Config& config) override {
@@ -133,10 +131,14 @@ struct GIPass : RenderPass {
 
         // Create vertex buffers
         objects.resize(scene.worldData.shapes.size());
+        size_t nbVerts = 0, nbCorners = 0;
         for (size_t i = 0; i < objects.size(); i++) {
             buildVBO(i);
             buildVAO(i);
+            nbVerts += objects[i].nVerts;
+            nbCorners += objects[i].nIndices;
         }
+        std::cout << "GI baked at " << nbVerts << " vertices (" << nbCorners << " triangle corners)" << std::endl;
 
         return true;
     }
@@ -145,6 +147,7 @@ struct GIPass : RenderPass {
         // Delete vertex buffers
         for (size_t i = 0; i < objects.size(); i++) {
             glDeleteBuffers(1, &objects[i].vbo);
+            glDeleteBuffers(1, &objects[i].ebo);
             glDeleteVertexArrays(1, &objects[i].vao);
         }
 
@@ -177,10 +180,10 @@ struct GIPass : RenderPass {
         //4) Draw its triangles.
         //5) Unbind the vertex array.
         for (size_t i = 0; i < objects.size(); i++) {
-            GLObject obj = objects[i];
+            const GLObject& obj = objects[i];
 
-            glBindVertexArray(obj.vbo);
-            glDrawArrays(GL_TRIANGLES, 0, obj.nVerts);
+            glBindVertexArray(obj.vao);
+            glDrawElements(GL_TRIANGLES, obj.nIndices, GL_UNSIGNED_INT, (GLvoid*) 0);
             glBindVertexArray(0);
 
         }
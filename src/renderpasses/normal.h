@@ -55,6 +55,7 @@ struct NormalPass : RenderPass {
         // Delete vertex buffers
         for (size_t i = 0; i < objects.size(); i++) {
             glDeleteBuffers(1, &objects[i].vbo);
+            glDeleteBuffers(1, &objects[i].ebo);
             glDeleteVertexArrays(1, &objects[i].vao);
         }
 
@@ -38,7 +38,7 @@ struct SimplePass : RenderPass {
         for (size_t i = 0; i < objects.size(); i++) {
             buildVBO(i);
             buildVAO(i);
-            assignShader(objects[i], shapes[i], scene.bsdfs);
+            assignShader(objects[i], i, scene.bsdfs);
         }
 
         return true;
@@ -48,6 +48,7 @@ struct SimplePass : RenderPass {
         // Delete vertex buffers
         for (size_t i = 0; i < objects.size(); i++) {
             glDeleteBuffers(1, &objects[i].vbo);
+            glDeleteBuffers(1, &objects[i].ebo);
             glDeleteVertexArrays(1, &objects[i].vao);
         }
 
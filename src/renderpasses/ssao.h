@@ -144,6 +144,7 @@ struct SSAOPass : RenderPass {
         for (size_t i = 0; i < objects.size(); i++) {
             GLObject obj = objects[i];
             glDeleteBuffers(1, &obj.vbo);
+            glDeleteBuffers(1, &obj.ebo);
             glDeleteVertexArrays(1, &obj.vao);
         }
 
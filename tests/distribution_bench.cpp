@@ -0,0 +1,65 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/sampler.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace TinyRender;
+
+/**
+ * Microbenchmark of Distribution1D::sample() through the CDF against the alias table, for sizes around
+ * AliasThreshold and AliasMaxSize. Also reports how many bits of a float sample are left to choose between an entry
+ * and its alias, which bounds the accuracy of the table.
+ */
+namespace {
+
+const size_t SampleCount = size_t(1) << 20;
+
+double timePerSample(const Distribution1D& dist, const std::vector<float>& samples, size_t& checksum) {
+    for (size_t k = 0; k < samples.size(); k += 64) checksum += dist.sample(samples[k]);   // Warm up
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (float u : samples) checksum += dist.sample(u);
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / double(samples.size());
+}
+
+}
+
+int main() {
+#ifndef NDEBUG
+    std::printf("Warning: unoptimized build, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+    Sampler sampler(0x5EED5EEDu, 13u);
+    std::vector<float> samples(SampleCount);
+    for (float& u : samples) u = sampler.next();
+    size_t checksum = 0;
+
+    std::printf("%10s %10s %10s %10s %12s\n", "size", "CDF", "alias", "speedup", "alias bits");
+    for (size_t n = 4; n <= (size_t(1) << 22); n *= 2) {
+        Distribution1D dist;
+        for (size_t i = 0; i < n; i++) {
+            const float u = sampler.next();
+            dist.add(u * u);
+        }
+        dist.normalize();
+
+        dist.bins.clear();
+        const double cdf = timePerSample(dist, samples, checksum);
+        dist.buildAliasTable();
+        const double alias = timePerSample(dist, samples, checksum);
+
+        const int bits = 24 - int(std::ceil(std::log2(double(n))));
+        const char* mark = n == Distribution1D::AliasThreshold ? "  <- AliasThreshold"
+                         : n == Distribution1D::AliasMaxSize ? "  <- AliasMaxSize" : "";
+        std::printf("%10zu %7.2f ns %7.2f ns %9.1fx %12d%s\n", n, cdf, alias, cdf / alias, bits, mark);
+    }
+
+    std::printf("(checksum %zu)\n", checksum);
+    return 0;
+}
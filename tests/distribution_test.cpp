@@ -0,0 +1,111 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/sampler.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace TinyRender;
+
+/**
+ * Statistical tests of Distribution1D: histograms of sample() against pdf(), through the CDF and the alias table,
+ * on either side of AliasThreshold and AliasMaxSize.
+ */
+namespace {
+
+const double Significance = 0.01;
+
+/** Random weights spanning a few orders of magnitude, with every seventh one zero. */
+std::vector<float> getWeights(size_t n, Sampler& sampler) {
+    std::vector<float> weights(n);
+    for (size_t i = 0; i < n; i++) {
+        const float u = sampler.next();
+        weights[i] = i % 7 == 3 ? 0.f : u * u * u * u;
+    }
+    return weights;
+}
+
+/** See warp_test.cpp. */
+double chiSquarePValue(double chi2, int dof) {
+    const double k = double(dof);
+    const double z = (std::cbrt(chi2 / k) - (1. - 2. / (9. * k))) / std::sqrt(2. / (9. * k));
+    return 0.5 * std::erfc(z / std::sqrt(2.));
+}
+
+/**
+ * Draws a histogram of samples and compares it with pdf(), pooling the entries that expect fewer than 5 samples.
+ * Also checks that pdf() agrees with the normalized weights, up to the precision of differences of a float CDF,
+ * and that zero-weight entries are never sampled.
+ */
+bool testHistogram(const std::string& name, const Distribution1D& dist, const std::vector<float>& weights,
+                   size_t sampleCount, Sampler& sampler) {
+    const size_t n = weights.size();
+    double sum = 0.;
+    for (float w : weights) sum += w;
+    double pdfError = 0.;
+    for (size_t i = 0; i < n; i++)
+        pdfError = std::max(pdfError, std::abs(dist.pdf(i) - weights[i] / sum) * double(n));
+
+    std::vector<double> observed(n, 0.);
+    size_t zeroHits = 0;
+    for (size_t k = 0; k < sampleCount; k++) {
+        const int i = dist.sample(sampler.next());
+        observed[i] += 1.;
+        if (weights[i] == 0.f) zeroHits++;
+    }
+
+    double chi2 = 0., pooledObserved = 0., pooledExpected = 0.;
+    int dof = -1;
+    for (size_t i = 0; i < n; i++) {
+        const double expected = dist.pdf(i) * double(sampleCount);
+        if (expected < 5.) {
+            pooledObserved += observed[i];
+            pooledExpected += expected;
+            continue;
+        }
+        chi2 += (observed[i] - expected) * (observed[i] - expected) / expected;
+        dof++;
+    }
+    if (pooledExpected > 0.) {
+        chi2 += (pooledObserved - pooledExpected) * (pooledObserved - pooledExpected) / pooledExpected;
+        dof++;
+    }
+
+    const double p = chiSquarePValue(chi2, dof);
+    const bool pass = p > Significance && zeroHits == 0 && pdfError < 1e-4 + 1e-6 * double(n);
+    std::printf("%-6s %-24s chi-square %10.1f (%d dof, p = %.3f), pdf error %.1e, zero-weight hits %zu\n",
+                pass ? "[ok]" : "[FAIL]", name.c_str(), chi2, dof, p, pdfError, zeroHits);
+    return pass;
+}
+
+}
+
+int main() {
+    Sampler sampler(0x5EED5EEDu, 11u);
+    bool pass = true;
+    const size_t sizes[] = {5, Distribution1D::AliasThreshold - 1, Distribution1D::AliasThreshold, 1000,
+                            Distribution1D::AliasMaxSize, Distribution1D::AliasMaxSize + 1};
+    for (size_t n : sizes) {
+        const std::vector<float> weights = getWeights(n, sampler);
+        Distribution1D dist;
+        for (float w : weights) dist.add(w);
+        dist.normalize();
+        const size_t sampleCount = std::max(size_t(1) << 20, 64 * n);
+        const bool alias = !dist.bins.empty();
+        pass &= testHistogram("n=" + std::to_string(n) + (alias ? " (alias)" : " (CDF)"), dist, weights,
+                              sampleCount, sampler);
+
+        // The other method on the same weights, except for alias tables past AliasMaxSize, which are known to be biased
+        if (n > Distribution1D::AliasMaxSize) continue;
+        if (alias) dist.bins.clear();
+        else dist.buildAliasTable();
+        pass &= testHistogram("n=" + std::to_string(n) + (alias ? " (CDF)" : " (alias)"), dist, weights,
+                              sampleCount, sampler);
+    }
+    return pass ? 0 : 1;
+}
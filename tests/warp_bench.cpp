@@ -0,0 +1,100 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/sampler.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace TinyRender;
+
+/**
+ * Microbenchmark of the scalar warps (with their pdf) against the batched ones, on a batch of samples that stays
+ * in L1/L2. Reports nanoseconds per sample.
+ */
+namespace {
+
+const size_t BatchSize = 4096;
+const int Repeats = 2000;
+
+template<typename F>
+double timePerSample(F f) {
+    f();   // Warm up
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < Repeats; r++) f();
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double(Repeats) * BatchSize);
+}
+
+/** Sums the outputs, so that the compiler cannot drop the warps. */
+float checksum(const std::vector<v3f>& dirs, const std::vector<float>& pdfs) {
+    float sum = 0.f;
+    for (size_t i = 0; i < dirs.size(); i++) sum += dirs[i].x + dirs[i].y + dirs[i].z + pdfs[i];
+    return sum;
+}
+
+}
+
+int main() {
+#ifndef NDEBUG
+    std::printf("Warning: unoptimized build, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+#ifdef __AVX2__
+    std::printf("Batched warps: AVX2\n");
+#else
+    std::printf("Batched warps: scalar\n");
+#endif
+
+    Sampler sampler(0x5EED5EEDu, 7u);
+    std::vector<p2f> samples(BatchSize);
+    for (p2f& s : samples) s = sampler.next2D();
+    std::vector<v3f> dirs(BatchSize);
+    std::vector<float> pdfs(BatchSize);
+    float sum = 0.f;
+
+    double scalar = timePerSample([&]() {
+        for (size_t i = 0; i < BatchSize; i++) {
+            dirs[i] = Warp::squareToUniformSphere(samples[i]);
+            pdfs[i] = Warp::squareToUniformSpherePdf();
+        }
+    });
+    sum += checksum(dirs, pdfs);
+    double batch = timePerSample([&]() { Warp::squareToUniformSphere(samples.data(), dirs.data(), pdfs.data(), BatchSize); });
+    sum += checksum(dirs, pdfs);
+    std::printf("%-20s scalar %6.2f ns  batch %6.2f ns  (x%.1f)\n", "uniform sphere", scalar, batch, scalar / batch);
+
+    scalar = timePerSample([&]() {
+        for (size_t i = 0; i < BatchSize; i++) {
+            dirs[i] = Warp::squareToCosineHemisphere(samples[i]);
+            pdfs[i] = Warp::squareToCosineHemispherePdf(dirs[i]);
+        }
+    });
+    sum += checksum(dirs, pdfs);
+    batch = timePerSample([&]() { Warp::squareToCosineHemisphere(samples.data(), dirs.data(), pdfs.data(), BatchSize); });
+    sum += checksum(dirs, pdfs);
+    std::printf("%-20s scalar %6.2f ns  batch %6.2f ns  (x%.1f)\n", "cosine hemisphere", scalar, batch, scalar / batch);
+
+    for (float exponent : {5.f, 500.f}) {
+        scalar = timePerSample([&]() {
+            for (size_t i = 0; i < BatchSize; i++) {
+                dirs[i] = Warp::squareToPhongLobe(samples[i], exponent);
+                pdfs[i] = Warp::squareToPhongLobePdf(dirs[i], exponent);
+            }
+        });
+        sum += checksum(dirs, pdfs);
+        batch = timePerSample([&]() {
+            Warp::squareToPhongLobe(samples.data(), exponent, dirs.data(), pdfs.data(), BatchSize);
+        });
+        sum += checksum(dirs, pdfs);
+        const std::string name = "Phong lobe n=" + std::to_string(int(exponent));
+        std::printf("%-20s scalar %6.2f ns  batch %6.2f ns  (x%.1f)\n", name.c_str(), scalar, batch, scalar / batch);
+    }
+
+    std::printf("(checksum %g)\n", sum);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/sampler.h>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace TinyRender;
+
+/**
+ * Statistical tests of the warping functions: chi-square of the warped directions against their pdf, for the
+ * scalar warps and their batched variants (8-wide when built with AVX2), and agreement of the two.
+ * Returns 77 (skipped for CTest) when built for AVX2 on a CPU without it.
+ */
+namespace {
+
+const size_t SampleCount = 1 << 20;
+const int ThetaBins = 32, PhiBins = 64;
+const double Significance = 0.01;
+
+typedef std::function<void(const std::vector<p2f>&, std::vector<v3f>&, std::vector<float>&)> WarpFn;
+typedef std::function<float(const v3f&)> PdfFn;
+
+std::vector<p2f> getSamples(size_t n) {
+    Sampler sampler(0x5EED5EEDu, 7u);
+    std::vector<p2f> samples(n);
+    for (p2f& s : samples) s = sampler.next2D();
+    return samples;
+}
+
+/**
+ * p-value of a chi-square statistic with dof degrees of freedom (Wilson-Hilferty approximation, accurate to a
+ * few percent above 30 dof).
+ */
+double chiSquarePValue(double chi2, int dof) {
+    const double k = double(dof);
+    const double z = (std::cbrt(chi2 / k) - (1. - 2. / (9. * k))) / std::sqrt(2. / (9. * k));
+    return 0.5 * std::erfc(z / std::sqrt(2.));
+}
+
+/**
+ * Bins the directions over (cos theta, phi) and compares the counts with the pdf integrated over each bin.
+ * Bins expecting fewer than 5 samples are pooled.
+ */
+bool testChiSquare(const std::string& name, const std::vector<v3f>& dirs, const PdfFn& pdf, int thetaBins) {
+    const int nBins = thetaBins * PhiBins;
+    std::vector<double> observed(size_t(nBins), 0.), expected(size_t(nBins), 0.);
+    for (const v3f& d : dirs) {
+        float phi = std::atan2(d.y, d.x);
+        if (phi < 0.f) phi += 2.f * M_PI;
+        const int i = clamp(int((clamp(d.z, -1.f, 1.f) + 1.f) * 0.5f * thetaBins), 0, thetaBins - 1);
+        const int j = clamp(int(phi * INV_TWOPI * PhiBins), 0, PhiBins - 1);
+        observed[i * PhiBins + j] += 1.;
+    }
+
+    const int sub = 16;   // Midpoint rule per bin
+    const double binArea = (2. / thetaBins) * (2. * M_PI / PhiBins) / (sub * sub);
+    for (int i = 0; i < thetaBins; i++) {
+        for (int j = 0; j < PhiBins; j++) {
+            double integral = 0.;
+            for (int u = 0; u < sub; u++) {
+                for (int v = 0; v < sub; v++) {
+                    const double z = -1. + 2. * (i + (u + .5) / sub) / thetaBins;
+                    const double phi = 2. * M_PI * (j + (v + .5) / sub) / PhiBins;
+                    const double r = std::sqrt(std::max(0., 1. - z * z));
+                    integral += pdf(v3f(r * std::cos(phi), r * std::sin(phi), z));
+                }
+            }
+            expected[i * PhiBins + j] = integral * binArea * double(dirs.size());
+        }
+    }
+
+    double chi2 = 0., pooledObserved = 0., pooledExpected = 0.;
+    int dof = -1;
+    for (int k = 0; k < nBins; k++) {
+        if (expected[k] < 5.) {
+            pooledObserved += observed[k];
+            pooledExpected += expected[k];
+            continue;
+        }
+        chi2 += (observed[k] - expected[k]) * (observed[k] - expected[k]) / expected[k];
+        dof++;
+    }
+    if (pooledExpected > 0.) {
+        chi2 += (pooledObserved - pooledExpected) * (pooledObserved - pooledExpected) / pooledExpected;
+        dof++;
+    }
+
+    const double p = chiSquarePValue(chi2, dof);
+    const bool pass = p > Significance;
+    std::printf("%-6s chi-square %-28s %10.1f (%d dof, p = %.3f)\n", pass ? "[ok]" : "[FAIL]", name.c_str(),
+                chi2, dof, p);
+    return pass;
+}
+
+/**
+ * Largest difference between the directions of two warps, and between their pdfs (relative, or absolute below 1:
+ * near the horizon cos theta loses most of its bits to cancellation in float).
+ */
+bool testAgreement(const std::string& name, const std::vector<v3f>& dirsA, const std::vector<float>& pdfsA,
+                   const std::vector<v3f>& dirsB, const std::vector<float>& pdfsB, double tolerance) {
+    double dirError = 0., pdfError = 0.;
+    for (size_t i = 0; i < dirsA.size(); i++) {
+        dirError = std::max(dirError, double(glm::length(dirsA[i] - dirsB[i])));
+        pdfError = std::max(pdfError, std::abs(double(pdfsB[i]) - pdfsA[i]) / std::max(double(pdfsA[i]), 1.));
+    }
+    const bool pass = dirError < tolerance && pdfError < tolerance;
+    std::printf("%-6s batch vs scalar %-23s  directions %.2e, pdfs %.2e\n", pass ? "[ok]" : "[FAIL]", name.c_str(),
+                dirError, pdfError);
+    return pass;
+}
+
+}
+
+int main() {
+#ifdef __AVX2__
+#if defined(__GNUC__)
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma")) {
+        std::printf("Skipped: the CPU does not support AVX2\n");
+        return 77;
+    }
+#endif
+    std::printf("Batched warps: AVX2\n");
+#else
+    std::printf("Batched warps: scalar\n");
+#endif
+
+    struct WarpCase {
+        std::string name;
+        std::function<v3f(const p2f&)> warp;
+        WarpFn batch;
+        PdfFn pdf;
+        int thetaBins;
+    };
+    std::vector<WarpCase> cases;
+    cases.push_back({"uniform sphere",
+                     [](const p2f& s) { return Warp::squareToUniformSphere(s); },
+                     [](const std::vector<p2f>& s, std::vector<v3f>& d, std::vector<float>& p) {
+                         Warp::squareToUniformSphere(s.data(), d.data(), p.data(), s.size());
+                     },
+                     [](const v3f&) { return Warp::squareToUniformSpherePdf(); }, ThetaBins});
+    cases.push_back({"cosine hemisphere",
+                     [](const p2f& s) { return Warp::squareToCosineHemisphere(s); },
+                     [](const std::vector<p2f>& s, std::vector<v3f>& d, std::vector<float>& p) {
+                         Warp::squareToCosineHemisphere(s.data(), d.data(), p.data(), s.size());
+                     },
+                     [](const v3f& v) { return v.z > 0.f ? Warp::squareToCosineHemispherePdf(v) : 0.f; }, ThetaBins});
+    for (float exponent : {1.f, 5.f, 50.f, 500.f}) {
+        cases.push_back({"Phong lobe n=" + std::to_string(int(exponent)),
+                         [exponent](const p2f& s) { return Warp::squareToPhongLobe(s, exponent); },
+                         [exponent](const std::vector<p2f>& s, std::vector<v3f>& d, std::vector<float>& p) {
+                             Warp::squareToPhongLobe(s.data(), exponent, d.data(), p.data(), s.size());
+                         },
+                         [exponent](const v3f& v) { return v.z > 0.f ? Warp::squareToPhongLobePdf(v, exponent) : 0.f; },
+                         exponent > 100.f ? 8 * ThetaBins : ThetaBins});
+    }
+
+    // One sample short of a multiple of 8, so that the batches also run their scalar tail
+    const std::vector<p2f> samples = getSamples(SampleCount - 1);
+    bool pass = true;
+    for (const WarpCase& c : cases) {
+        std::vector<v3f> dirs(samples.size()), batchDirs(samples.size());
+        std::vector<float> pdfs(samples.size()), batchPdfs(samples.size());
+        for (size_t i = 0; i < samples.size(); i++) {
+            dirs[i] = c.warp(samples[i]);
+            pdfs[i] = c.pdf(dirs[i]);
+        }
+        c.batch(samples, batchDirs, batchPdfs);
+
+        pass &= testChiSquare(c.name + " (scalar)", dirs, c.pdf, c.thetaBins);
+        pass &= testChiSquare(c.name + " (batch)", batchDirs, c.pdf, c.thetaBins);
+        pass &= testAgreement(c.name, dirs, pdfs, batchDirs, batchPdfs, 1e-3);
+    }
+    return pass ? 0 : 1;
+}